@@ -0,0 +1,81 @@
+//
+// Measures the throughput of parsec::csv::Reader.
+//
+// Usage: csv_bench [file.csv...]
+//
+// When no file is given, a wide numeric file is generated instead.
+//
+
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "parsec/csv.hpp"
+
+using namespace parsec;
+
+static std::string
+readFile(const std::string& path)
+{
+  std::ifstream file{ path, std::ios::binary };
+  std::stringstream buffer{};
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+static std::string
+syntheticFile()
+{
+  std::string file{};
+  for (int row = 0; row < 200000; row++)
+    {
+      for (int column = 0; column < 32; column++)
+        {
+          if (column > 0) file += ',';
+          file += std::to_string((row * 31 + column * 7) % 100000);
+        }
+      file += '\n';
+    }
+  return file;
+}
+
+static void
+bench(const std::string& name, const std::string& input)
+{
+  using clock = std::chrono::steady_clock;
+
+  std::size_t iterations = 0;
+  std::size_t fields = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration{};
+  while (elapsed < std::chrono::seconds(1))
+    {
+      csv::forEachRow(input, [&](const csv::Row& row) {
+        fields += row.size();
+      });
+      iterations++;
+      elapsed = clock::now() - start;
+    }
+
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  auto gigabytes = static_cast<double>(input.size() * iterations) / 1e9;
+  std::cout << name << ": " << gigabytes / seconds << " GB/s, "
+            << static_cast<double>(fields) / seconds / 1e6
+            << " M fields/s\n";
+}
+
+auto
+main(int argc, char** argv) -> int
+{
+  if (argc < 2)
+    {
+      bench("synthetic", syntheticFile());
+      return 0;
+    }
+
+  for (int i = 1; i < argc; i++) bench(argv[i], readFile(argv[i]));
+  return 0;
+}
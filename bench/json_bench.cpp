@@ -0,0 +1,86 @@
+//
+// Measures the throughput of parsec::json::Reader.
+//
+// Usage: json_bench [file.json...]
+//
+// The usual corpora are twitter.json, citm_catalog.json and canada.json from
+// https://github.com/miloyip/nativejson-benchmark/tree/master/data. When no
+// file is given, a synthetic document is generated instead.
+//
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "parsec/json.hpp"
+
+using namespace parsec;
+
+static std::string
+readFile(const std::string& path)
+{
+  std::ifstream file{ path, std::ios::binary };
+  std::stringstream buffer{};
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+static std::string
+syntheticDocument()
+{
+  std::string document{ "[" };
+  for (int i = 0; i < 20000; i++)
+    {
+      if (i > 0) document += ",";
+      document += R"({"id":)" + std::to_string(i)
+                + R"(,"name":"user \")" + std::to_string(i)
+                + R"(\"","score":)" + std::to_string(i * 0.25)
+                + R"(,"tags":["a","b","c"],"active":true,"parent":null})";
+    }
+  document += "]";
+  return document;
+}
+
+static void
+bench(const std::string& name, const std::string& input)
+{
+  using clock = std::chrono::steady_clock;
+  json::Reader reader{};
+
+  if (auto result = reader.parse(input); result.isFailure())
+    {
+      std::cerr << name << ": " << result.asError().show() << "\n";
+      return;
+    }
+
+  std::size_t iterations = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration{};
+  while (elapsed < std::chrono::seconds(1))
+    {
+      auto result = reader.parse(input);
+      if (result.isFailure()) return;
+      iterations++;
+      elapsed = clock::now() - start;
+    }
+
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  auto megabytes = static_cast<double>(input.size() * iterations) / 1e6;
+  std::cout << name << ": " << megabytes / seconds << " MB/s ("
+            << iterations << " iterations)\n";
+}
+
+auto
+main(int argc, char** argv) -> int
+{
+  if (argc < 2)
+    {
+      bench("synthetic", syntheticDocument());
+      return 0;
+    }
+
+  for (int i = 1; i < argc; i++) bench(argv[i], readFile(argv[i]));
+  return 0;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * Counts which branch of an adaptiveChoice() succeeds, and the order in
+ * which its branches are tried. Every period calls, the branches are sorted
+ * by how often they succeeded during those calls, so that the order follows
+ * the input as it drifts. A period of 0 keeps the declared order.
+ *
+ * A stats object belongs to a single adaptiveChoice(), which rejects one
+ * already in use, and is not synchronized: the parser must not run
+ * concurrently.
+ */
+class BranchStats
+{
+public:
+  explicit BranchStats(std::size_t period = 1024) : m_period{ period } {}
+
+  BranchStats(const BranchStats&) = delete;
+  BranchStats& operator=(const BranchStats&) = delete;
+
+  /**
+   * The number of branches.
+   */
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_successes.size();
+  }
+
+  /**
+   * The number of times branch, in declaration order, succeeded.
+   */
+  [[nodiscard]] std::size_t
+  successes(std::size_t branch) const noexcept
+  {
+    return m_successes[branch];
+  }
+
+  /**
+   * The number of calls in which every branch failed.
+   */
+  [[nodiscard]] std::size_t
+  failures() const noexcept
+  {
+    return m_failures;
+  }
+
+  /**
+   * The number of branches run, which reordering aims to keep low.
+   */
+  [[nodiscard]] std::size_t
+  attempts() const noexcept
+  {
+    return m_attempts;
+  }
+
+  /**
+   * The branches, in declaration order, in the order they are tried.
+   */
+  [[nodiscard]] const std::vector<std::size_t>&
+  order() const noexcept
+  {
+    return m_order;
+  }
+
+private:
+  template <typename T, typename Input, typename... Parsers>
+  friend Parser<T, Input> adaptiveChoice(BranchStats& stats,
+                                         const Parser<T, Input>& first,
+                                         const Parsers&... rest);
+
+  void
+  start(std::size_t branches)
+  {
+    if (size() != 0)
+      throw ParserError::create("adaptive choice",
+                                "Branch statistics already in use");
+    m_successes.assign(branches, 0);
+    m_recent.assign(branches, 0);
+    m_order.resize(branches);
+    std::iota(m_order.begin(), m_order.end(), 0);
+  }
+
+  void
+  record(std::optional<std::size_t> branch)
+  {
+    if (branch)
+      {
+        m_successes[*branch]++;
+        m_recent[*branch]++;
+      }
+    else
+      m_failures++;
+
+    // A branch may recurse into the choice, e.g. for nested values, so the
+    // order only changes once the outermost call is done with it.
+    if (m_period != 0 && ++m_calls % m_period == 0) m_stale = true;
+    if (!m_stale || m_depth != 0) return;
+    std::stable_sort(m_order.begin(), m_order.end(),
+                     [this](std::size_t a, std::size_t b) {
+                       return m_recent[a] > m_recent[b];
+                     });
+    std::fill(m_recent.begin(), m_recent.end(), 0);
+    m_stale = false;
+  }
+
+  std::size_t m_period;
+  std::vector<std::size_t> m_successes{};
+  std::vector<std::size_t> m_recent{}; // Successes since the last sort.
+  std::vector<std::size_t> m_order{};
+  std::size_t m_failures = 0;
+  std::size_t m_attempts = 0;
+  std::size_t m_calls = 0;
+  std::size_t m_depth = 0; // Calls in progress.
+  bool m_stale = false;
+};
+
+/**
+ * Return the result of the first parser that succeeds, like choice(), but
+ * try the parsers that succeeded most often recently first, as counted by
+ * stats. The parsers must be order independent: at most one of them may
+ * succeed on any input, or it must not matter which one does. When they
+ * all fail, the error is the one of the last parser, as with choice(),
+ * whatever the order they were tried in.
+ *
+ * The returned parser refers to stats, which has to outlive it.
+ */
+template <typename T, typename Input, typename... Parsers>
+[[nodiscard]] Parser<T, Input>
+adaptiveChoice(BranchStats& stats,
+               const Parser<T, Input>& first,
+               const Parsers&... rest)
+{
+  using result_type = typename Parser<T, Input>::result_type;
+  std::vector<Parser<T, Input> > branches{ first, rest... };
+  stats.start(branches.size());
+  auto label = (first.getLabel() + ... + (" or " + rest.getLabel()));
+
+  return Parser<T, Input>(
+      label, [branches, &stats](Input input) -> result_type {
+        std::optional<result_type> result{};
+        std::optional<result_type> last{};
+        std::optional<std::size_t> succeeded{};
+        stats.m_depth++;
+        for (auto branch : stats.order())
+          {
+            stats.m_attempts++;
+            auto attempt = branches[branch].run(input);
+            if (attempt.isSuccess() || attempt.isFatal())
+              {
+                if (attempt.isSuccess()) succeeded = branch;
+                result.emplace(std::move(attempt));
+                break;
+              }
+            if (branch == branches.size() - 1) last.emplace(std::move(attempt));
+          }
+        stats.m_depth--;
+        stats.record(succeeded);
+        return std::move(result ? *result : *last);
+      });
+}
+
+} // namespace parsec
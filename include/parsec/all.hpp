@@ -1,5 +1,24 @@
 #pragma once
 
 #include "adapter.hpp"
+#include "adaptive.hpp"
+#include "arena.hpp"
+#include "binary.hpp"
+#include "cache.hpp"
+#include "columns.hpp"
+#include "csv.hpp"
+#include "diagnostics.hpp"
+#include "expr.hpp"
+#include "incremental.hpp"
+#include "intern.hpp"
+#include "ir.hpp"
+#include "json.hpp"
+#include "lexer.hpp"
 #include "parsec.hpp"
 #include "parsers.hpp"
+#include "peg.hpp"
+#include "regex.hpp"
+#include "source.hpp"
+#include "stream.hpp"
+#include "utf8.hpp"
+#include "vm.hpp"
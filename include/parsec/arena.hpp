@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace parsec
+{
+
+/**
+ * Bump allocator for bytes that have to outlive the input they were parsed
+ * from. Allocations never move, and blocks are kept across calls to clear, so
+ * a reused Arena stops allocating once it has seen its largest input.
+ */
+class Arena
+{
+public:
+  [[nodiscard]] char*
+  allocate(std::size_t size)
+  {
+    for (; m_current < m_blocks.size(); m_current++, m_used = 0)
+      {
+        if (m_used + size <= m_blocks[m_current].size)
+          {
+            auto data = m_blocks[m_current].data.get() + m_used;
+            m_used += size;
+            return data;
+          }
+      }
+
+    auto blockSize = std::max(size, kBlockSize);
+    m_blocks.push_back({ std::make_unique<char[]>(blockSize), blockSize });
+    m_used = size;
+    return m_blocks.back().data.get();
+  }
+
+  /**
+   * Copy s into the arena.
+   */
+  [[nodiscard]] std::string_view
+  store(std::string_view s)
+  {
+    auto data = allocate(s.size());
+    std::copy(s.begin(), s.end(), data);
+    return { data, s.size() };
+  }
+
+  void
+  clear() noexcept
+  {
+    m_current = 0;
+    m_used = 0;
+  }
+
+private:
+  static constexpr std::size_t kBlockSize = 64 * 1024;
+
+  struct Block
+  {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  std::vector<Block> m_blocks{};
+  std::size_t m_current = 0;
+  std::size_t m_used = 0;
+};
+
+} // namespace parsec
@@ -0,0 +1,541 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+namespace detail
+{
+
+/**
+ * A deterministic automaton compiled from a list of regular expressions.
+ *
+ * Patterns support literals, ".", character classes such as "[a-z_]" or
+ * "[^\"]", the escapes \d \w \s (and their negations \D \W \S), \n \t \r \f
+ * \v \xHH, grouping, alternation and the *, +, ? and {n,m} quantifiers.
+ * Patterns match bytes, so UTF-8 text can be matched literally.
+ *
+ * Patterns are compiled into a Thompson NFA and then into a DFA by subset
+ * construction. Bytes that no pattern tells apart share a column of the
+ * transition table, which keeps it small. Both automata are bounded in size,
+ * so that a hostile pattern, e.g. "a{1000}{1000}", fails to compile instead
+ * of exhausting memory.
+ */
+class Automaton
+{
+public:
+  struct Match
+  {
+    std::size_t length;
+    int pattern; // The index of the pattern, or -1 if nothing matched.
+  };
+
+  /**
+   * Compile patterns. When several patterns match the same longest prefix,
+   * the one that comes first wins.
+   * @throws ParserError if there are no patterns, or if a pattern is
+   * malformed or compiles to too large an automaton.
+   */
+  explicit Automaton(const std::vector<std::string>& patterns)
+  {
+    if (patterns.empty())
+      throw ParserError::create("regex", "Expected at least one pattern");
+    Nfa nfa{};
+    std::vector<int> starts{};
+    for (std::size_t i = 0; i < patterns.size(); i++)
+      starts.push_back(nfa.compile(patterns[i], static_cast<int>(i)));
+    build(nfa, starts);
+  }
+
+  /**
+   * Find the longest prefix of input matched by a pattern.
+   */
+  [[nodiscard]] Match
+  longest(std::string_view input) const noexcept
+  {
+    std::uint32_t state = start;
+    Match match{ 0, m_accept[state] };
+    for (std::size_t i = 0; i < input.size(); i++)
+      {
+        auto byte = static_cast<unsigned char>(input[i]);
+        state = m_table[state * m_width + m_classes[byte]];
+        if (state == dead) break;
+        if (m_accept[state] >= 0) match = { i + 1, m_accept[state] };
+      }
+    return match;
+  }
+
+  /**
+   * The number of states of the automaton, including the dead state.
+   */
+  [[nodiscard]] std::size_t
+  states() const noexcept
+  {
+    return m_accept.size();
+  }
+
+private:
+  static constexpr std::uint32_t dead = 0;
+  static constexpr std::uint32_t start = 1;
+
+  // Bounds on the size of the automata, and on the counts of repetitions.
+  static constexpr std::size_t maxNfaStates = 1 << 16;
+  static constexpr std::size_t maxStates = 1 << 14;
+  static constexpr std::size_t maxBound = 1000;
+
+  using Set = std::bitset<256>;
+
+  struct Nfa
+  {
+    // A state either moves to next on a byte of sets[set], or, when set is
+    // -1, moves to next and alt without consuming input.
+    struct State
+    {
+      int set = -1;
+      int next = -1;
+      int alt = -1;
+      int accept = -1;
+    };
+
+    struct Fragment
+    {
+      int start;
+      int end;
+    };
+
+    std::vector<State> states{};
+    std::vector<Set> sets{};
+
+    int
+    compile(std::string_view pattern, int index)
+    {
+      Compiler compiler{ *this, pattern };
+      auto fragment = compiler.alternation();
+      if (compiler.pos != pattern.size())
+        compiler.fail("Unbalanced parenthesis");
+      states[fragment.end].accept = index;
+      return fragment.start;
+    }
+
+    int
+    add()
+    {
+      return add(State{});
+    }
+
+    int
+    add(State state)
+    {
+      if (states.size() == maxNfaStates)
+        throw ParserError::create("regex", "Pattern too large");
+      states.push_back(state);
+      return static_cast<int>(states.size()) - 1;
+    }
+
+    Fragment
+    empty()
+    {
+      auto state = add();
+      return { state, state };
+    }
+
+    Fragment
+    match(const Set& set)
+    {
+      sets.push_back(set);
+      auto end = add();
+      return { add({ static_cast<int>(sets.size()) - 1, end }), end };
+    }
+
+    Fragment
+    concat(Fragment a, Fragment b)
+    {
+      states[a.end].next = b.start;
+      return { a.start, b.end };
+    }
+
+    Fragment
+    either(Fragment a, Fragment b)
+    {
+      auto end = add();
+      states[a.end].next = end;
+      states[b.end].next = end;
+      return { add({ -1, a.start, b.start }), end };
+    }
+
+    Fragment
+    optional(Fragment a)
+    {
+      auto end = add();
+      states[a.end].next = end;
+      return { add({ -1, a.start, end }), end };
+    }
+
+    Fragment
+    star(Fragment a)
+    {
+      auto end = add();
+      auto loop = add({ -1, a.start, end });
+      states[a.end].next = loop;
+      return { loop, end };
+    }
+
+    Fragment
+    plus(Fragment a)
+    {
+      auto end = add();
+      auto loop = add({ -1, a.start, end });
+      states[a.end].next = loop;
+      return { a.start, end };
+    }
+  };
+
+  // Recursive descent over the syntax of a pattern, building NFA fragments
+  // as it goes.
+  struct Compiler
+  {
+    Nfa& nfa;
+    std::string_view pattern;
+    std::size_t pos = 0;
+
+    [[noreturn]] void
+    fail(const std::string& message) const
+    {
+      throw ParserError::create("regex", message + " in \""
+                                             + std::string(pattern) + "\"");
+    }
+
+    [[nodiscard]] bool
+    at(char c) const noexcept
+    {
+      return pos < pattern.size() && pattern[pos] == c;
+    }
+
+    Nfa::Fragment
+    alternation()
+    {
+      auto fragment = sequence();
+      while (at('|'))
+        {
+          pos++;
+          fragment = nfa.either(fragment, sequence());
+        }
+      return fragment;
+    }
+
+    Nfa::Fragment
+    sequence()
+    {
+      auto fragment = nfa.empty();
+      while (pos < pattern.size() && !at('|') && !at(')'))
+        fragment = nfa.concat(fragment, repetition());
+      return fragment;
+    }
+
+    Nfa::Fragment
+    repetition()
+    {
+      auto begin = pos;
+      auto fragment = atom();
+
+      while (pos < pattern.size())
+        {
+          if (at('*'))
+            fragment = nfa.star(fragment);
+          else if (at('+'))
+            fragment = nfa.plus(fragment);
+          else if (at('?'))
+            fragment = nfa.optional(fragment);
+          else if (at('{'))
+            {
+              fragment = bounded(fragment, begin);
+              continue;
+            }
+          else
+            break;
+          pos++;
+        }
+      return fragment;
+    }
+
+    // Expands a{n,m} into n copies of a followed by m - n optional ones,
+    // compiling a again from its source for each copy. a is the atom at
+    // begin along with the quantifiers that follow it up to the brace, e.g.
+    // "x?" in "x?{2}".
+    Nfa::Fragment
+    bounded(Nfa::Fragment fragment, std::size_t begin)
+    {
+      auto brace = pos;
+      pos++;
+      auto min = number();
+      auto max = min;
+      bool unbounded = false;
+      if (at(','))
+        {
+          pos++;
+          if (at('}'))
+            unbounded = true;
+          else
+            max = number();
+        }
+      if (!at('}')) fail("Expected '}'");
+      pos++;
+      if (!unbounded && max < min) fail("Invalid repetition bounds");
+
+      auto after = pos;
+      auto copy = [&] {
+        Compiler compiler{ nfa, pattern.substr(0, brace), begin };
+        return compiler.repetition();
+      };
+
+      auto result = min == 0 ? nfa.empty() : fragment;
+      for (std::size_t i = 1; i < min; i++) result = nfa.concat(result, copy());
+      if (unbounded)
+        result = nfa.concat(result, nfa.star(min == 0 ? fragment : copy()));
+      else
+        for (std::size_t i = min; i < max; i++)
+          result = nfa.concat(result, nfa.optional(i == 0 ? fragment : copy()));
+      pos = after;
+      return result;
+    }
+
+    std::size_t
+    number()
+    {
+      if (pos >= pattern.size() || pattern[pos] < '0' || pattern[pos] > '9')
+        fail("Expected a number");
+      std::size_t n = 0;
+      while (pos < pattern.size() && pattern[pos] >= '0' && pattern[pos] <= '9')
+        {
+          n = n * 10 + static_cast<std::size_t>(pattern[pos++] - '0');
+          if (n > maxBound) fail("Repetition bound too large");
+        }
+      return n;
+    }
+
+    Nfa::Fragment
+    atom()
+    {
+      if (pos >= pattern.size()) fail("Unexpected end of pattern");
+      auto c = pattern[pos++];
+      switch (c)
+        {
+        case '(':
+          {
+            auto fragment = alternation();
+            if (!at(')')) fail("Expected ')'");
+            pos++;
+            return fragment;
+          }
+        case '[':
+          return nfa.match(charClass());
+        case '.':
+          return nfa.match(Set{}.set().reset('\n'));
+        case '\\':
+          return nfa.match(escape());
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case ')':
+          fail(std::string("Unexpected '") + c + "'");
+        default:
+          return nfa.match(Set{}.set(static_cast<unsigned char>(c)));
+        }
+    }
+
+    Set
+    escape()
+    {
+      if (pos >= pattern.size()) fail("Unterminated escape");
+      auto c = pattern[pos++];
+      Set set{};
+      switch (c)
+        {
+        case 'd':
+        case 'D':
+          for (int b = '0'; b <= '9'; b++) set.set(b);
+          break;
+        case 'w':
+        case 'W':
+          for (int b = 0; b < 256; b++)
+            if ((b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z')
+                || (b >= '0' && b <= '9') || b == '_')
+              set.set(b);
+          break;
+        case 's':
+        case 'S':
+          for (char b : std::string_view(" \t\n\r\f\v")) set.set(b);
+          break;
+        case 'n': return set.set('\n');
+        case 't': return set.set('\t');
+        case 'r': return set.set('\r');
+        case 'f': return set.set('\f');
+        case 'v': return set.set('\v');
+        case 'x':
+          {
+            if (pos + 2 > pattern.size()) fail("Invalid \\x escape");
+            int value = 0;
+            for (int i = 0; i < 2; i++)
+              {
+                auto h = pattern[pos++];
+                int digit = h >= '0' && h <= '9'   ? h - '0'
+                          : h >= 'a' && h <= 'f' ? h - 'a' + 10
+                          : h >= 'A' && h <= 'F' ? h - 'A' + 10
+                                                 : -1;
+                if (digit < 0) fail("Invalid \\x escape");
+                value = value * 16 + digit;
+              }
+            return set.set(static_cast<std::size_t>(value));
+          }
+        default:
+          return set.set(static_cast<unsigned char>(c));
+        }
+      return c >= 'A' && c <= 'Z' ? ~set : set;
+    }
+
+    Set
+    charClass()
+    {
+      Set set{};
+      bool negated = at('^');
+      if (negated) pos++;
+
+      bool first = true;
+      while (pos < pattern.size() && (first || !at(']')))
+        {
+          first = false;
+          if (at('\\'))
+            {
+              pos++;
+              set |= escape();
+              continue;
+            }
+          auto lo = static_cast<unsigned char>(pattern[pos++]);
+          if (at('-') && pos + 1 < pattern.size() && pattern[pos + 1] != ']')
+            {
+              pos++;
+              auto hi = static_cast<unsigned char>(pattern[pos++]);
+              if (hi < lo) fail("Invalid range");
+              for (unsigned b = lo; b <= hi; b++) set.set(b);
+            }
+          else
+            set.set(lo);
+        }
+      if (!at(']')) fail("Unterminated character class");
+      pos++;
+      return negated ? ~set : set;
+    }
+  };
+
+  void
+  build(const Nfa& nfa, const std::vector<int>& starts)
+  {
+    // Partition the bytes into classes that every set treats alike.
+    m_classes.fill(0);
+    std::size_t classes = 1;
+    for (const auto& set : nfa.sets)
+      {
+        std::map<std::pair<int, bool>, std::uint8_t> refined{};
+        for (int b = 0; b < 256; b++)
+          {
+            auto key = std::pair{ static_cast<int>(m_classes[b]), set[b] };
+            auto [it, inserted] = refined.try_emplace(
+                key, static_cast<std::uint8_t>(refined.size())
+            );
+            m_classes[b] = it->second;
+          }
+        classes = refined.size();
+      }
+    m_width = classes;
+
+    std::vector<unsigned char> representative(classes);
+    for (int b = 255; b >= 0; b--)
+      representative[m_classes[b]] = static_cast<unsigned char>(b);
+
+    std::vector<char> seen(nfa.states.size());
+    auto closure = [&](std::vector<int> stack) {
+      std::fill(seen.begin(), seen.end(), 0);
+      std::vector<int> result{};
+      while (!stack.empty())
+        {
+          auto s = stack.back();
+          stack.pop_back();
+          if (s < 0 || seen[s]) continue;
+          seen[s] = 1;
+          result.push_back(s);
+          if (nfa.states[s].set < 0)
+            {
+              stack.push_back(nfa.states[s].next);
+              stack.push_back(nfa.states[s].alt);
+            }
+        }
+      std::sort(result.begin(), result.end());
+      return result;
+    };
+
+    std::map<std::vector<int>, std::uint32_t> ids{};
+    std::vector<std::vector<int> > pending{};
+    auto intern = [&](std::vector<int> set) -> std::uint32_t {
+      if (set.empty()) return dead;
+      auto [it, inserted]
+          = ids.try_emplace(set, static_cast<std::uint32_t>(m_accept.size()));
+      if (inserted)
+        {
+          if (m_accept.size() == maxStates)
+            throw ParserError::create("regex", "Pattern too large");
+          int accept = -1;
+          for (auto s : set)
+            if (nfa.states[s].accept >= 0
+                && (accept < 0 || nfa.states[s].accept < accept))
+              accept = nfa.states[s].accept;
+          m_accept.push_back(accept);
+          m_table.resize(m_table.size() + m_width, dead);
+          pending.push_back(std::move(set));
+        }
+      return it->second;
+    };
+
+    m_accept.push_back(-1);
+    m_table.resize(m_width, dead);
+    intern(closure(starts));
+
+    for (std::uint32_t state = start; state < m_accept.size(); state++)
+      {
+        auto set = pending[state - start];
+        for (std::size_t c = 0; c < classes; c++)
+          {
+            std::vector<int> moves{};
+            for (auto s : set)
+              {
+                const auto& from = nfa.states[s];
+                if (from.set >= 0 && nfa.sets[from.set][representative[c]])
+                  moves.push_back(from.next);
+              }
+            // intern may grow the table, so look the slot up afterwards.
+            auto target = intern(closure(std::move(moves)));
+            m_table[state * m_width + c] = target;
+          }
+      }
+  }
+
+  std::array<std::uint8_t, 256> m_classes{};
+  std::size_t m_width = 1;
+  std::vector<std::uint32_t> m_table{};
+  std::vector<int> m_accept{};
+};
+
+} // namespace detail
+
+} // namespace parsec
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * View a buffer of bytes as parser input.
+ */
+[[nodiscard]] static inline std::string_view
+fromBytes(std::span<const std::byte> bytes) noexcept
+{
+  return { reinterpret_cast<const char*>(bytes.data()), bytes.size() };
+}
+
+namespace detail
+{
+
+template <typename U>
+[[nodiscard]] constexpr U
+byteswap(U value) noexcept
+{
+  static_assert(std::is_unsigned_v<U>);
+  if constexpr (sizeof(U) == 1)
+    return value;
+#if defined(__GNUC__) || defined(__clang__)
+  else if constexpr (sizeof(U) == 2)
+    return __builtin_bswap16(value);
+  else if constexpr (sizeof(U) == 4)
+    return __builtin_bswap32(value);
+  else if constexpr (sizeof(U) == 8)
+    return __builtin_bswap64(value);
+#endif
+  else
+    {
+      U result = 0;
+      for (std::size_t i = 0; i < sizeof(U); i++)
+        {
+          result = static_cast<U>((result << 8) | (value & 0xff));
+          value = static_cast<U>(value >> 8);
+        }
+      return result;
+    }
+}
+
+template <std::size_t Size>
+using unsigned_of_size = std::conditional_t<
+    Size == 1,
+    std::uint8_t,
+    std::conditional_t<
+        Size == 2,
+        std::uint16_t,
+        std::conditional_t<Size == 4, std::uint32_t, std::uint64_t> > >;
+
+/**
+ * Decode a T stored with the given byte order at an arbitrarily aligned
+ * address. The memcpy compiles down to a single unaligned load, followed by a
+ * byte swap when the byte order differs from the native one.
+ */
+template <typename T, std::endian Endian>
+[[nodiscard]] inline T
+load(const char* data) noexcept
+{
+  using U = unsigned_of_size<sizeof(T)>;
+  U raw;
+  std::memcpy(&raw, data, sizeof(U));
+  if constexpr (Endian != std::endian::native) raw = byteswap(raw);
+  return std::bit_cast<T>(raw);
+}
+
+} // namespace detail
+
+/**
+ * Parse a fixed width arithmetic value stored with the given byte order.
+ */
+template <typename T, std::endian Endian>
+[[nodiscard]] Parser<T>
+fixedWidth(const std::string& label) noexcept
+{
+  static_assert(std::is_arithmetic_v<T>);
+  return Parser<T>(
+      label,
+      [label](std::string_view input) -> typename Parser<T>::result_type {
+        if (input.size() < sizeof(T))
+          return ParserError::create(label, "Not enough input");
+        return make_success(detail::load<T, Endian>(input.data()),
+                            input.substr(sizeof(T)));
+      });
+}
+
+/**
+ * Parse a single byte.
+ */
+static inline Parser<std::uint8_t>
+u8()
+{
+  return fixedWidth<std::uint8_t, std::endian::little>("u8");
+}
+
+/**
+ * Parse a single signed byte.
+ */
+static inline Parser<std::int8_t>
+i8()
+{
+  return fixedWidth<std::int8_t, std::endian::little>("i8");
+}
+
+/**
+ * Parse fixed width unsigned integers.
+ */
+static inline Parser<std::uint16_t>
+u16le()
+{
+  return fixedWidth<std::uint16_t, std::endian::little>("u16le");
+}
+
+static inline Parser<std::uint16_t>
+u16be()
+{
+  return fixedWidth<std::uint16_t, std::endian::big>("u16be");
+}
+
+static inline Parser<std::uint32_t>
+u32le()
+{
+  return fixedWidth<std::uint32_t, std::endian::little>("u32le");
+}
+
+static inline Parser<std::uint32_t>
+u32be()
+{
+  return fixedWidth<std::uint32_t, std::endian::big>("u32be");
+}
+
+static inline Parser<std::uint64_t>
+u64le()
+{
+  return fixedWidth<std::uint64_t, std::endian::little>("u64le");
+}
+
+static inline Parser<std::uint64_t>
+u64be()
+{
+  return fixedWidth<std::uint64_t, std::endian::big>("u64be");
+}
+
+/**
+ * Parse fixed width two's complement integers.
+ */
+static inline Parser<std::int16_t>
+i16le()
+{
+  return fixedWidth<std::int16_t, std::endian::little>("i16le");
+}
+
+static inline Parser<std::int16_t>
+i16be()
+{
+  return fixedWidth<std::int16_t, std::endian::big>("i16be");
+}
+
+static inline Parser<std::int32_t>
+i32le()
+{
+  return fixedWidth<std::int32_t, std::endian::little>("i32le");
+}
+
+static inline Parser<std::int32_t>
+i32be()
+{
+  return fixedWidth<std::int32_t, std::endian::big>("i32be");
+}
+
+static inline Parser<std::int64_t>
+i64le()
+{
+  return fixedWidth<std::int64_t, std::endian::little>("i64le");
+}
+
+static inline Parser<std::int64_t>
+i64be()
+{
+  return fixedWidth<std::int64_t, std::endian::big>("i64be");
+}
+
+/**
+ * Parse IEEE 754 floating point numbers.
+ */
+static inline Parser<float>
+f32le()
+{
+  return fixedWidth<float, std::endian::little>("f32le");
+}
+
+static inline Parser<float>
+f32be()
+{
+  return fixedWidth<float, std::endian::big>("f32be");
+}
+
+static inline Parser<double>
+f64le()
+{
+  return fixedWidth<double, std::endian::little>("f64le");
+}
+
+static inline Parser<double>
+f64be()
+{
+  return fixedWidth<double, std::endian::big>("f64be");
+}
+
+/**
+ * Parse an unsigned LEB128 variable length integer, as used by protobuf.
+ */
+static inline Parser<std::uint64_t>
+varint()
+{
+  return Parser<std::uint64_t>(
+      "varint",
+      [](std::string_view input) -> Parser<std::uint64_t>::result_type {
+        std::uint64_t result = 0;
+        for (std::size_t i = 0; i < input.size() && i < 10; i++)
+          {
+            auto byte = static_cast<std::uint8_t>(input[i]);
+            if (i == 9 && byte > 1)
+              return ParserError::create("varint", "Value overflows 64 bits");
+            result |= static_cast<std::uint64_t>(byte & 0x7f) << (7 * i);
+            if ((byte & 0x80) == 0)
+              return make_success(result, input.substr(i + 1));
+          }
+        return ParserError::create("varint", "Unterminated varint");
+      });
+}
+
+/**
+ * Consume exactly n bytes.
+ * @return A view of the consumed bytes.
+ */
+static inline Parser<std::string_view>
+takeN(std::size_t n)
+{
+  auto label = "take " + std::to_string(n);
+  return Parser<std::string_view>(
+      label,
+      [n, label](
+          std::string_view input
+      ) -> Parser<std::string_view>::result_type {
+        if (input.size() < n)
+          return ParserError::create(label, "Not enough input");
+        return make_success(input.substr(0, n), input.substr(n));
+      });
+}
+
+/**
+ * Parse a length with lengthP and run p over a frame of exactly that many
+ * bytes. p has to consume the whole frame.
+ * @return The value returned by p.
+ */
+template <typename L, typename T>
+[[nodiscard]] Parser<T>
+lengthPrefixed(const Parser<L>& lengthP, const Parser<T>& p) noexcept
+{
+  static_assert(std::is_integral_v<L>);
+  auto label = p.getLabel() + " prefixed by " + lengthP.getLabel();
+  return Parser<T>(
+      label,
+      [lengthP, p, label](
+          std::string_view input
+      ) -> typename Parser<T>::result_type {
+        auto lengthResult = lengthP.run(input);
+        if (lengthResult.isFailure()) return lengthResult.asError();
+        auto [length, remaining] = lengthResult.value();
+
+        if (std::cmp_less(length, 0)
+            || std::cmp_less(remaining.size(), length))
+          return ParserError::create(label, "Frame exceeds the input");
+
+        auto frame = remaining.substr(0, length);
+        auto result = p.run(frame);
+        if (result.isFailure()) return result.asError();
+        if (!result.value().second.empty())
+          return ParserError::create(label, "Frame was not fully consumed");
+        return make_success(result.value().first, remaining.substr(length));
+      });
+}
+
+/**
+ * Run p over a frame prefixed by its length encoded as a varint.
+ */
+template <typename T>
+[[nodiscard]] Parser<T>
+lengthPrefixed(const Parser<T>& p) noexcept
+{
+  return lengthPrefixed(varint(), p);
+}
+
+} // namespace parsec
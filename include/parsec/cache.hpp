@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A bounded cache of the values parsed from fragments of input, evicting
+ * the least recently used fragment when full. See cached().
+ *
+ * A cache is not synchronized: parsers that use the same cache must not run
+ * concurrently.
+ */
+template <typename T>
+class ResultCache
+{
+public:
+  explicit ResultCache(std::size_t capacity) : m_capacity{ capacity } {}
+
+  ResultCache(const ResultCache&) = delete;
+  ResultCache& operator=(const ResultCache&) = delete;
+
+  /**
+   * The value parsed from the fragment input starts with, with the length
+   * of the fragment, if one was stored.
+   */
+  [[nodiscard]] std::optional<std::pair<T, std::size_t> >
+  find(std::string_view input)
+  {
+    // Fragments are looked up by length, extending the hash of the prefix
+    // of the input from one stored length to the next, so that the input
+    // is hashed at most once.
+    std::uint64_t hash = offset;
+    std::size_t hashed = 0;
+    for (auto [length, count] : m_lengths)
+      {
+        if (length > input.size()) break;
+        for (; hashed < length; hashed++) hash = mix(hash, input[hashed]);
+
+        auto [first, last] = m_index.equal_range(hash);
+        for (auto it = first; it != last; ++it)
+          {
+            auto entry = it->second;
+            if (!entry->matches(input)) continue;
+            m_entries.splice(m_entries.begin(), m_entries, entry);
+            m_hits++;
+            return std::pair{ entry->value, length };
+          }
+      }
+    m_misses++;
+    return std::nullopt;
+  }
+
+  /**
+   * Store the value parsed from the fragment input starts with.
+   */
+  void
+  store(std::string_view input, std::size_t length, const T& value)
+  {
+    if (m_capacity == 0 || length == 0) return;
+    if (m_entries.size() == m_capacity) evict();
+
+    auto fragment = input.substr(0, length);
+    int next = length < input.size()
+                 ? static_cast<unsigned char>(input[length])
+                 : Entry::end;
+    m_entries.push_front({ std::string(fragment), next, value });
+    m_index.emplace(hash(fragment), m_entries.begin());
+    m_lengths[length]++;
+  }
+
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_entries.size();
+  }
+
+  [[nodiscard]] std::size_t
+  hits() const noexcept
+  {
+    return m_hits;
+  }
+
+  [[nodiscard]] std::size_t
+  misses() const noexcept
+  {
+    return m_misses;
+  }
+
+  /**
+   * The share of lookups that were hits, or 0 if there were none.
+   */
+  [[nodiscard]] double
+  hitRate() const noexcept
+  {
+    auto lookups = m_hits + m_misses;
+    return lookups ? static_cast<double>(m_hits) / lookups : 0;
+  }
+
+private:
+  struct Entry
+  {
+    static constexpr int end = -1;
+
+    // The byte that followed the fragment, or end. Parsers usually look one
+    // byte past what they consume, e.g. to end a repetition, so a fragment
+    // only matches when followed by the same byte.
+    std::string fragment;
+    int next;
+    T value;
+
+    [[nodiscard]] bool
+    matches(std::string_view input) const noexcept
+    {
+      if (!input.starts_with(fragment)) return false;
+      if (input.size() == fragment.size()) return next == end;
+      return static_cast<unsigned char>(input[fragment.size()]) == next;
+    }
+  };
+
+  using iterator = typename std::list<Entry>::iterator;
+
+  static constexpr std::uint64_t offset = 0xcbf29ce484222325;
+
+  // FNV-1a, which can be extended one byte at a time.
+  static constexpr std::uint64_t
+  mix(std::uint64_t hash, char c) noexcept
+  {
+    return (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+  }
+
+  static std::uint64_t
+  hash(std::string_view fragment) noexcept
+  {
+    auto result = offset;
+    for (auto c : fragment) result = mix(result, c);
+    return result;
+  }
+
+  void
+  evict()
+  {
+    auto last = std::prev(m_entries.end());
+    auto [first, end] = m_index.equal_range(hash(last->fragment));
+    for (auto it = first; it != end; ++it)
+      if (it->second == last)
+        {
+          m_index.erase(it);
+          break;
+        }
+    if (--m_lengths[last->fragment.size()] == 0)
+      m_lengths.erase(last->fragment.size());
+    m_entries.pop_back();
+  }
+
+  std::size_t m_capacity;
+  std::list<Entry> m_entries{}; // Most recently used first.
+  std::unordered_multimap<std::uint64_t, iterator> m_index{};
+  std::map<std::size_t, std::size_t> m_lengths{}; // Entries by length.
+  std::size_t m_hits = 0;
+  std::size_t m_misses = 0;
+};
+
+/**
+ * Run p through cache: when the input starts with a fragment that p parsed
+ * before, followed by the same byte, its value is reused instead of parsing
+ * it again. This pays off for expensive parsers of fragments that repeat,
+ * e.g. user agents or header lines.
+ *
+ * p must not look more than one byte past what it consumes, and only its
+ * successes are cached. The returned parser refers to cache, which has to
+ * outlive it.
+ */
+template <typename T>
+[[nodiscard]] Parser<T>
+cached(const Parser<T>& p, ResultCache<T>& cache) noexcept
+{
+  return Parser<T>(
+      p.getLabel(),
+      [p, &cache](std::string_view input) -> typename Parser<T>::result_type {
+        if (auto hit = cache.find(input); hit)
+          return make_success(std::move(hit->first),
+                              input.substr(hit->second));
+
+        auto result = p.run(input);
+        if (result.isSuccess())
+          {
+            const auto& [value, remaining] = result.value();
+            cache.store(input, input.size() - remaining.size(), value);
+          }
+        return result;
+      });
+}
+
+} // namespace parsec
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A field of a record, parsed by parser and stored as a T. See record().
+ */
+template <typename T, typename U>
+struct Field
+{
+  Parser<U> parser;
+};
+
+/**
+ * Bind p to a column of Ts, e.g. column<int>(decimal()).
+ */
+template <typename T, typename U>
+[[nodiscard]] Field<T, U>
+column(const Parser<U>& p)
+{
+  return { p };
+}
+
+/**
+ * Records stored as one contiguous vector per field, a struct of arrays, so
+ * that each column can be scanned or aggregated on its own without going
+ * through an intermediate object per record.
+ */
+template <typename... Ts>
+class Columns
+{
+public:
+  template <std::size_t I>
+  [[nodiscard]] const auto&
+  column() const noexcept
+  {
+    return std::get<I>(m_columns);
+  }
+
+  /**
+   * The number of records.
+   */
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+  void
+  reserve(std::size_t records)
+  {
+    std::apply([records](auto&... columns) { (columns.reserve(records), ...); },
+               m_columns);
+  }
+
+  void
+  clear() noexcept
+  {
+    truncate(0);
+  }
+
+  /**
+   * Remove the records from the given one on, e.g. to go back to a size()
+   * taken before parsing. See transaction().
+   */
+  void
+  truncate(std::size_t records) noexcept
+  {
+    if (records > m_size) return;
+    std::apply(
+        [records](auto&... columns) {
+          (columns.erase(columns.begin() + records, columns.end()), ...);
+        },
+        m_columns);
+    m_size = records;
+  }
+
+private:
+  template <typename... Vs, typename... Us>
+  friend Parser<std::size_t>
+  record(Columns<Vs...>& columns, const Field<Vs, Us>&... fields);
+
+  std::tuple<std::vector<Ts>...> m_columns{};
+  std::size_t m_size = 0;
+};
+
+/**
+ * Parse a record made of the given fields, in order, appending the value of
+ * each field to its column. Separators belong to the fields, e.g.
+ *
+ *     Columns<std::string_view, int> people{};
+ *     auto person = record(people, column<std::string_view>(name < comma),
+ *                          column<int>(decimal()));
+ *     auto file = skipSepBy(person, charP('\n'));
+ *
+ * A record that fails to parse is removed from every column, so columns
+ * always have the same size. A record that parsed stays even if a parser it
+ * is part of fails afterwards, e.g. the left side of a choice, unless that
+ * parser runs as a transaction(). Views of the input that are stored refer
+ * to it. The returned parser refers to columns, which has to outlive it.
+ * @return The index of the record.
+ */
+template <typename... Ts, typename... Us>
+[[nodiscard]] Parser<std::size_t>
+record(Columns<Ts...>& columns, const Field<Ts, Us>&... fields)
+{
+  using result_type = Parser<std::size_t>::result_type;
+  auto parsers = std::tuple{ fields.parser... };
+  return Parser<std::size_t>(
+      "record", [parsers, &columns](std::string_view input) -> result_type {
+        auto index = columns.m_size;
+        std::optional<ParserError> error{};
+        auto field = [&](const auto& parser, auto& column) {
+          if (error) return;
+          auto result = parser.run(input);
+          if (result.isFailure())
+            {
+              error = std::move(result).asError();
+              return;
+            }
+          auto [value, rest] = std::move(result).value();
+          column.emplace_back(std::move(value));
+          input = rest;
+        };
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+          (field(std::get<I>(parsers), std::get<I>(columns.m_columns)), ...);
+        }(std::index_sequence_for<Ts...>{});
+
+        if (error)
+          {
+            columns.truncate(index);
+            return std::move(*error);
+          }
+        columns.m_size++;
+        return make_success(index, input);
+      });
+}
+
+/**
+ * Run p, removing the records it added to columns if it fails, so that
+ * parsers that backtrack over records do not leave them behind, e.g.
+ *
+ *     transaction(people, person < charP('!')) | other
+ *
+ * The returned parser refers to columns, which has to outlive it.
+ */
+template <typename T, typename... Ts>
+[[nodiscard]] Parser<T>
+transaction(Columns<Ts...>& columns, const Parser<T>& p)
+{
+  return Parser<T>(p.getLabel(), [p, &columns](std::string_view input) {
+    auto size = columns.size();
+    auto result = p.run(input);
+    if (result.isFailure()) columns.truncate(size);
+    return result;
+  });
+}
+
+} // namespace parsec
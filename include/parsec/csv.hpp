@@ -0,0 +1,338 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+namespace csv
+{
+
+struct Dialect
+{
+  char delimiter = ',';
+  char quote = '"';
+};
+
+static constexpr Dialect comma{ ',', '"' };
+static constexpr Dialect tab{ '\t', '"' };
+
+namespace detail
+{
+
+/**
+ * Finds the delimiters, quotes and line breaks of an input. Positions are
+ * computed 64 bytes at a time into a bit mask, so that locating the end of a
+ * short field usually costs a couple of bit operations.
+ */
+class Scanner
+{
+public:
+  Scanner(std::string_view input, Dialect dialect) noexcept
+      : m_input{ input }, m_dialect{ dialect }
+  {
+    if (!m_input.empty()) load(0);
+  }
+
+  /**
+   * The position of the first special character at or after pos, or the
+   * size of the input if there is none.
+   */
+  [[nodiscard]] std::size_t
+  next(std::size_t pos) noexcept
+  {
+    while (pos < m_input.size())
+      {
+        if (pos < m_block || pos >= m_block + 64) load(pos);
+        auto mask = m_mask & (~std::uint64_t{ 0 } << (pos - m_block));
+        if (mask) return m_block + std::countr_zero(mask);
+        pos = m_block + 64;
+      }
+    return m_input.size();
+  }
+
+private:
+  void
+  load(std::size_t block) noexcept
+  {
+    m_block = block;
+    m_mask = 0;
+    auto data = m_input.data() + block;
+    auto size = std::min<std::size_t>(64, m_input.size() - block);
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    auto delimiter = _mm_set1_epi8(m_dialect.delimiter);
+    auto quote = _mm_set1_epi8(m_dialect.quote);
+    auto lf = _mm_set1_epi8('\n');
+    auto cr = _mm_set1_epi8('\r');
+    for (; i + 16 <= size; i += 16)
+      {
+        auto chunk
+            = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, delimiter),
+                         _mm_cmpeq_epi8(chunk, quote)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, cr))
+        );
+        auto bits = static_cast<std::uint16_t>(_mm_movemask_epi8(special));
+        m_mask |= static_cast<std::uint64_t>(bits) << i;
+      }
+#endif
+
+    for (; i < size; i++)
+      if (isSpecial(data[i])) m_mask |= std::uint64_t{ 1 } << i;
+  }
+
+  [[nodiscard]] bool
+  isSpecial(char c) const noexcept
+  {
+    return c == m_dialect.delimiter || c == m_dialect.quote || c == '\n'
+        || c == '\r';
+  }
+
+  std::string_view m_input;
+  Dialect m_dialect;
+  std::size_t m_block = 0;
+  std::uint64_t m_mask = 0;
+};
+
+} // namespace detail
+
+/**
+ * The fields of a record. Fields are views into the input, except for quoted
+ * fields with escaped quotes, which are unescaped into storage owned by the
+ * Row. Fields are valid until the Row is reused.
+ */
+class Row
+{
+public:
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_fields.size();
+  }
+
+  [[nodiscard]] std::string_view
+  operator[](std::size_t i) const noexcept
+  {
+    return m_fields[i];
+  }
+
+  [[nodiscard]] auto
+  begin() const noexcept
+  {
+    return m_fields.begin();
+  }
+
+  [[nodiscard]] auto
+  end() const noexcept
+  {
+    return m_fields.end();
+  }
+
+  /**
+   * Run p over the i-th field. p has to consume the whole field.
+   */
+  template <typename T>
+  [[nodiscard]] ParseResult<T>
+  parse(std::size_t i, const Parser<T>& p) const
+  {
+    auto result = p.run(m_fields[i]);
+    if (result.isFailure()) return std::move(result).asError();
+    auto [value, remaining] = std::move(result).value();
+    if (!remaining.empty())
+      return ParserError::create(p.getLabel(), "Field was not fully consumed");
+    return ParseResult<T>::success(std::move(value));
+  }
+
+private:
+  friend class Reader;
+
+  struct Unescaped
+  {
+    std::size_t field;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  void
+  clear() noexcept
+  {
+    m_fields.clear();
+    m_unescaped.clear();
+    m_scratch.clear();
+  }
+
+  // Point the unescaped fields at the scratch buffer, which does not move
+  // anymore once the whole record has been read.
+  void
+  finish() noexcept
+  {
+    for (auto [field, offset, size] : m_unescaped)
+      m_fields[field] = std::string_view(m_scratch).substr(offset, size);
+  }
+
+  std::vector<std::string_view> m_fields{};
+  std::vector<Unescaped> m_unescaped{};
+  std::string m_scratch{};
+};
+
+/**
+ * Splits an input into records, as described by RFC 4180. Records end with
+ * either "\n" or "\r\n".
+ */
+class Reader
+{
+public:
+  explicit Reader(std::string_view input, Dialect dialect = comma)
+      : m_input{ input }, m_dialect{ dialect }, m_scanner{ input, dialect }
+  {
+  }
+
+  /**
+   * Read the next record into row, reusing its memory.
+   * @return false once the input is exhausted.
+   * @throws ParserError if a quoted field is malformed.
+   */
+  bool
+  next(Row& row)
+  {
+    row.clear();
+    if (m_pos >= m_input.size()) return false;
+
+    while (1)
+      {
+        auto end = m_input[m_pos] == m_dialect.quote ? quoted(row)
+                                                      : unquoted(row);
+        m_pos = end + 1;
+        if (end >= m_input.size()) break;
+        if (m_input[end] == m_dialect.delimiter)
+          {
+            if (m_pos == m_input.size()) row.m_fields.emplace_back();
+            if (m_pos >= m_input.size()) break;
+            continue;
+          }
+        if (m_input[end] == '\r' && m_pos < m_input.size()
+            && m_input[m_pos] == '\n')
+          m_pos++;
+        break;
+      }
+
+    row.finish();
+    return true;
+  }
+
+  /**
+   * The offset of the next record in the input.
+   */
+  [[nodiscard]] std::size_t
+  offset() const noexcept
+  {
+    return m_pos;
+  }
+
+private:
+  // Reads an unquoted field and returns the position of the character that
+  // ends it.
+  std::size_t
+  unquoted(Row& row) noexcept
+  {
+    auto end = m_scanner.next(m_pos);
+    while (end < m_input.size() && m_input[end] == m_dialect.quote)
+      end = m_scanner.next(end + 1);
+    row.m_fields.push_back(m_input.substr(m_pos, end - m_pos));
+    return end;
+  }
+
+  // Reads a quoted field and returns the position of the character that
+  // follows its closing quote.
+  std::size_t
+  quoted(Row& row)
+  {
+    auto data = m_input.data();
+    auto start = m_pos + 1;
+    auto pos = start;
+    bool escaped = false;
+
+    while (1)
+      {
+        auto quote = static_cast<const char*>(std::memchr(
+            data + pos, m_dialect.quote, m_input.size() - pos
+        ));
+        if (!quote)
+          throw ParserError::create("csv field", "Unterminated quoted field");
+        pos = static_cast<std::size_t>(quote - data) + 1;
+        if (pos < m_input.size() && m_input[pos] == m_dialect.quote)
+          {
+            escaped = true;
+            pos++;
+            continue;
+          }
+        break;
+      }
+
+    if (pos < m_input.size() && m_input[pos] != m_dialect.delimiter
+        && m_input[pos] != '\n' && m_input[pos] != '\r')
+      throw ParserError::create("csv field", "Unexpected character after "
+                                             "closing quote");
+
+    auto field = m_input.substr(start, pos - 1 - start);
+    if (!escaped)
+      {
+        row.m_fields.push_back(field);
+        return pos;
+      }
+
+    auto offset = row.m_scratch.size();
+    for (std::size_t i = 0; i < field.size(); i++)
+      {
+        row.m_scratch += field[i];
+        if (field[i] == m_dialect.quote) i++;
+      }
+    row.m_unescaped.push_back(
+        { row.m_fields.size(), offset, row.m_scratch.size() - offset }
+    );
+    row.m_fields.emplace_back();
+    return pos;
+  }
+
+  std::string_view m_input;
+  Dialect m_dialect;
+  detail::Scanner m_scanner;
+  std::size_t m_pos = 0;
+};
+
+/**
+ * Parse every record of input, calling f with each Row.
+ * @return The number of records.
+ */
+template <typename F>
+std::size_t
+forEachRow(std::string_view input, F f, Dialect dialect = comma)
+{
+  Reader reader{ input, dialect };
+  Row row{};
+  std::size_t n = 0;
+  while (reader.next(row))
+    {
+      f(static_cast<const Row&>(row));
+      n++;
+    }
+  return n;
+}
+
+} // namespace csv
+
+} // namespace parsec
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * An error reported while recovering, with the offset into the input at
+ * which the failing parser started.
+ */
+struct Diagnostic
+{
+  std::size_t offset;
+  ParserError error;
+
+  [[nodiscard]] std::string
+  show() const
+  {
+    return "offset " + std::to_string(offset) + ": " + error.show();
+  }
+};
+
+/**
+ * Collects the errors that recover() steps over, so that a single pass over
+ * an input reports every malformed part of it.
+ *
+ * A sink is not synchronized: parsers that report into the same sink must
+ * not run concurrently.
+ */
+class Diagnostics
+{
+public:
+  /**
+   * Start collecting errors for input. Once limit errors have been
+   * reported, recover() stops recovering and parsing fails as usual.
+   */
+  template <typename Input>
+  explicit Diagnostics(const Input& input,
+                       std::size_t limit
+                       = std::numeric_limits<std::size_t>::max())
+      : m_size{ input.size() }, m_limit{ limit }
+  {
+  }
+
+  /**
+   * Forget the errors reported so far and start over with input.
+   */
+  template <typename Input>
+  void
+  reset(const Input& input) noexcept
+  {
+    m_size = input.size();
+    m_diagnostics.clear();
+  }
+
+  /**
+   * Report an error found where remaining starts, remaining being a suffix
+   * of the input.
+   * @return false if the limit of errors has been reached.
+   */
+  template <typename Input>
+  bool
+  report(const Input& remaining, ParserError error)
+  {
+    if (full()) return false;
+    m_diagnostics.push_back({ m_size - remaining.size(), std::move(error) });
+    return true;
+  }
+
+  /**
+   * Forget the errors from the given one on, e.g. to go back to a size()
+   * taken before parsing. See transaction().
+   */
+  void
+  truncate(std::size_t count) noexcept
+  {
+    if (count < m_diagnostics.size())
+      m_diagnostics.erase(m_diagnostics.begin() + count, m_diagnostics.end());
+  }
+
+  [[nodiscard]] bool
+  full() const noexcept
+  {
+    return m_diagnostics.size() >= m_limit;
+  }
+
+  [[nodiscard]] bool
+  empty() const noexcept
+  {
+    return m_diagnostics.empty();
+  }
+
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_diagnostics.size();
+  }
+
+  [[nodiscard]] const Diagnostic&
+  operator[](std::size_t i) const noexcept
+  {
+    return m_diagnostics[i];
+  }
+
+  [[nodiscard]] auto
+  begin() const noexcept
+  {
+    return m_diagnostics.begin();
+  }
+
+  [[nodiscard]] auto
+  end() const noexcept
+  {
+    return m_diagnostics.end();
+  }
+
+private:
+  std::size_t m_size;
+  std::size_t m_limit;
+  std::vector<Diagnostic> m_diagnostics{};
+};
+
+/**
+ * Run p, and if it fails, report its error to diagnostics and skip the input
+ * with sync, e.g. skipUntil(charP('\n')), instead of failing.
+ *
+ * Parsing only fails if sync does or skips nothing, if diagnostics is full,
+ * or if p fails with a fatal error, which is not recovered from. Errors are
+ * reported as soon as they are skipped, so they stay even if a parser this
+ * one is part of fails afterwards and the input is parsed another way, e.g.
+ * by the right side of a choice, unless that parser runs as a transaction().
+ * The returned parser refers to diagnostics, which has to outlive it.
+ * @return The value returned by p, or std::nullopt if it was skipped.
+ */
+template <typename T, typename S, typename Input>
+[[nodiscard]] Parser<std::optional<T>, Input>
+recover(const Parser<T, Input>& p,
+        const Parser<S, Input>& sync,
+        Diagnostics& diagnostics) noexcept
+{
+  using result_type = typename Parser<std::optional<T>, Input>::result_type;
+  return Parser<std::optional<T>, Input>(
+      p.getLabel() + " recovering with " + sync.getLabel(),
+      [p, sync, &diagnostics](Input input) -> result_type {
+        auto result = p.run(input);
+        if (result.isSuccess())
+          {
+            auto [value, remaining] = std::move(result).value();
+            return make_success(std::optional<T>{ std::move(value) },
+                                remaining);
+          }
+
+        if (result.isFatal()) return std::move(result).asError();
+
+        // Skipping nothing would make e.g. many(recover(...)) loop forever.
+        auto skipped = sync.run(input);
+        if (skipped.isFatal()) return std::move(skipped).asError();
+        if (skipped.isFailure() || diagnostics.full()
+            || skipped.value().second.size() == input.size())
+          return std::move(result).asError();
+        diagnostics.report(input, std::move(result).asError());
+        return make_success(std::optional<T>{}, skipped.value().second);
+      });
+}
+
+/**
+ * Run p, forgetting the errors it reported to diagnostics if it fails, so
+ * that parsers that backtrack over recovered input do not leave its errors
+ * behind, e.g.
+ *
+ *     transaction(diagnostics, recover(p, sync, diagnostics) < semi) | other
+ *
+ * The returned parser refers to diagnostics, which has to outlive it.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Parser<T, Input>
+transaction(Diagnostics& diagnostics, const Parser<T, Input>& p)
+{
+  return Parser<T, Input>(p.getLabel(), [p, &diagnostics](Input input) {
+    auto size = diagnostics.size();
+    auto result = p.run(input);
+    if (result.isFailure()) diagnostics.truncate(size);
+    return result;
+  });
+}
+
+} // namespace parsec
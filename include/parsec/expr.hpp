@@ -0,0 +1,353 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+enum class Fixity
+{
+  InfixLeft,
+  InfixRight,
+  InfixNone,
+  Prefix,
+  Postfix,
+};
+
+/**
+ * An entry of an OperatorTable. Binary operators parse a function of two
+ * operands, unary operators a function of one.
+ */
+template <typename T, typename Input = std::string_view>
+struct Operator
+{
+  using binary_type = std::function<T(T, T)>;
+  using unary_type = std::function<T(T)>;
+
+  Fixity fixity;
+  std::optional<Parser<binary_type, Input> > binary{};
+  std::optional<Parser<unary_type, Input> > unary{};
+};
+
+/**
+ * The operators of an expression grammar grouped by precedence level, from
+ * the level that binds tightest to the loosest one, as in Parsec's
+ * buildExpressionParser.
+ */
+template <typename T, typename Input = std::string_view>
+using OperatorTable = std::vector<std::vector<Operator<T, Input> > >;
+
+/**
+ * Left associative binary operator.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Operator<T, Input>
+infixl(const Parser<std::function<T(T, T)>, Input>& op)
+{
+  return { Fixity::InfixLeft, op };
+}
+
+/**
+ * Left associative binary operator parsed by op and evaluated with f.
+ */
+template <typename T, typename U, typename Input, typename F>
+[[nodiscard]] Operator<T, Input>
+infixl(const Parser<U, Input>& op, F f)
+{
+  return infixl(op > pure<Input>(std::function<T(T, T)>(f)));
+}
+
+/**
+ * Right associative binary operator.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Operator<T, Input>
+infixr(const Parser<std::function<T(T, T)>, Input>& op)
+{
+  return { Fixity::InfixRight, op };
+}
+
+template <typename T, typename U, typename Input, typename F>
+[[nodiscard]] Operator<T, Input>
+infixr(const Parser<U, Input>& op, F f)
+{
+  return infixr(op > pure<Input>(std::function<T(T, T)>(f)));
+}
+
+/**
+ * Non associative binary operator: "a < b < c" is an error.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Operator<T, Input>
+infixn(const Parser<std::function<T(T, T)>, Input>& op)
+{
+  return { Fixity::InfixNone, op };
+}
+
+template <typename T, typename U, typename Input, typename F>
+[[nodiscard]] Operator<T, Input>
+infixn(const Parser<U, Input>& op, F f)
+{
+  return infixn(op > pure<Input>(std::function<T(T, T)>(f)));
+}
+
+/**
+ * Unary operator that precedes its operand.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Operator<T, Input>
+prefix(const Parser<std::function<T(T)>, Input>& op)
+{
+  return { Fixity::Prefix, std::nullopt, op };
+}
+
+template <typename T, typename U, typename Input, typename F>
+[[nodiscard]] Operator<T, Input>
+prefix(const Parser<U, Input>& op, F f)
+{
+  return prefix(op > pure<Input>(std::function<T(T)>(f)));
+}
+
+/**
+ * Unary operator that follows its operand.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Operator<T, Input>
+postfix(const Parser<std::function<T(T)>, Input>& op)
+{
+  return { Fixity::Postfix, std::nullopt, op };
+}
+
+template <typename T, typename U, typename Input, typename F>
+[[nodiscard]] Operator<T, Input>
+postfix(const Parser<U, Input>& op, F f)
+{
+  return postfix(op > pure<Input>(std::function<T(T)>(f)));
+}
+
+namespace detail
+{
+
+/**
+ * Precedence climbing over a flattened OperatorTable.
+ *
+ * Every operand and every operator is parsed exactly once: an operator that
+ * binds looser than the current level is handed back to the caller instead of
+ * being parsed again, and the recursion only goes as deep as the operators
+ * actually nest rather than once per precedence level.
+ */
+template <typename T, typename Input>
+class Expression
+{
+public:
+  using result_type = typename Parser<T, Input>::result_type;
+
+  Expression(const Parser<T, Input>& term, const OperatorTable<T, Input>& table)
+      : m_term{ term }
+  {
+    auto levels = static_cast<int>(table.size());
+    for (int level = 0; level < levels; level++)
+      for (const auto& op : table[level])
+        {
+          auto precedence = levels - level;
+          switch (op.fixity)
+            {
+            case Fixity::Prefix:
+              m_prefix.push_back({ precedence, *op.unary });
+              break;
+            case Fixity::Postfix:
+              m_postfix.push_back({ precedence, *op.unary });
+              break;
+            default:
+              m_infix.push_back({ precedence, op.fixity, *op.binary });
+              break;
+            }
+        }
+  }
+
+  result_type
+  operator()(Input input) const
+  {
+    std::optional<Pending> next{};
+    auto result = climb(input, 0, next);
+    if (next && next->ambiguous)
+      return ParserError::create("expression", "Ambiguous use of a "
+                                               "non-associative operator");
+    return result;
+  }
+
+private:
+  struct Unary
+  {
+    int precedence;
+    Parser<std::function<T(T)>, Input> op;
+  };
+
+  struct Binary
+  {
+    int precedence;
+    Fixity fixity;
+    Parser<std::function<T(T, T)>, Input> op;
+  };
+
+  // An operator that has been parsed but not applied yet. A stuck operator
+  // is one whose right operand failed; it stops every enclosing level, which
+  // then leaves the input right before it. An operator parser that failed
+  // with a fatal error fails every level instead.
+  struct Pending
+  {
+    int precedence;
+    Fixity fixity;
+    std::function<T(T, T)> binary{};
+    std::function<T(T)> unary{};
+    Input rest{};
+    bool stuck = false;
+    bool ambiguous = false;
+    std::optional<ParserError> fatal{};
+  };
+
+  // Operands nest as deeply as the operators, see DepthLimit.
+  result_type
+  nested(Input input, int minPrecedence, std::optional<Pending>& next) const
+  {
+    return detail::deeper("expression",
+                          [&] { return climb(input, minPrecedence, next); });
+  }
+
+  static Pending
+  failed(ParserError error)
+  {
+    Pending pending{ 0, Fixity::InfixNone };
+    pending.fatal = std::move(error);
+    return pending;
+  }
+
+  result_type
+  climb(Input input, int minPrecedence, std::optional<Pending>& next) const
+  {
+    auto operand = prefixed(input, next);
+    if (operand.isFailure()) return operand;
+    auto [lhs, remaining] = std::move(operand).value();
+
+    int nonAssociative = -1;
+    while (1)
+      {
+        if (!next) next = scan(remaining);
+        if (next && next->fatal) return *next->fatal;
+        if (!next || next->stuck || next->ambiguous) break;
+        if (next->precedence < minPrecedence) break;
+
+        if (next->fixity == Fixity::Postfix)
+          {
+            lhs = next->unary(std::move(lhs));
+            remaining = next->rest;
+            next.reset();
+            continue;
+          }
+
+        if (next->fixity == Fixity::InfixNone)
+          {
+            if (next->precedence == nonAssociative)
+              {
+                next->ambiguous = true;
+                break;
+              }
+            nonAssociative = next->precedence;
+          }
+
+        auto op = std::move(*next);
+        next.reset();
+        auto rhs = nested(op.rest,
+                          op.fixity == Fixity::InfixRight ? op.precedence
+                                                          : op.precedence + 1,
+                          next);
+        if (rhs.isFatal()) return rhs;
+        if (rhs.isFailure())
+          {
+            op.stuck = true;
+            next = std::move(op);
+            break;
+          }
+        auto [y, rest] = std::move(rhs).value();
+        lhs = op.binary(std::move(lhs), std::move(y));
+        remaining = rest;
+      }
+
+    return make_success(std::move(lhs), remaining);
+  }
+
+  // Parses a term preceded by any number of prefix operators.
+  result_type
+  prefixed(Input input, std::optional<Pending>& next) const
+  {
+    for (const auto& [precedence, op] : m_prefix)
+      {
+        auto result = op.run(input);
+        if (result.isFatal()) return std::move(result).asError();
+        if (result.isFailure()) continue;
+        auto [f, rest] = std::move(result).value();
+
+        auto operand = nested(rest, precedence, next);
+        if (operand.isFailure()) return operand;
+        auto [x, remaining] = std::move(operand).value();
+        return make_success(f(std::move(x)), remaining);
+      }
+    return m_term.run(input);
+  }
+
+  // Parses the operator that follows an operand. Postfix operators are tried
+  // before binary ones, each in table order.
+  std::optional<Pending>
+  scan(Input input) const
+  {
+    for (const auto& [precedence, op] : m_postfix)
+      if (auto result = op.run(input); result.isSuccess())
+        {
+          auto [f, rest] = std::move(result).value();
+          return Pending{ precedence, Fixity::Postfix, {}, std::move(f), rest };
+        }
+      else if (result.isFatal())
+        return failed(std::move(result).asError());
+    for (const auto& [precedence, fixity, op] : m_infix)
+      if (auto result = op.run(input); result.isSuccess())
+        {
+          auto [f, rest] = std::move(result).value();
+          return Pending{ precedence, fixity, std::move(f), {}, rest };
+        }
+      else if (result.isFatal())
+        return failed(std::move(result).asError());
+    return std::nullopt;
+  }
+
+  Parser<T, Input> m_term;
+  std::vector<Unary> m_prefix{};
+  std::vector<Unary> m_postfix{};
+  std::vector<Binary> m_infix{};
+};
+
+} // namespace detail
+
+/**
+ * Parse expressions made of terms and the operators of table in a single
+ * pass, without backtracking over operands.
+ *
+ * Operators of a level are tried in order, so when an operator is a prefix
+ * of another one, e.g. "<" and "<=", list the longer one first. An operator
+ * whose right operand fails to parse is left unconsumed.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Parser<T, Input>
+expression(const Parser<T, Input>& term, const OperatorTable<T, Input>& table)
+{
+  return Parser<T, Input>(term.getLabel() + " expression",
+                          detail::Expression<T, Input>{ term, table });
+}
+
+} // namespace parsec
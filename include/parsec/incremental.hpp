@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+namespace detail
+{
+
+/**
+ * The results of one incremental parser, by the offset at which it ran.
+ */
+class IncrementalTable
+{
+public:
+  virtual ~IncrementalTable() = default;
+
+  /**
+   * Drop the results that depend on the removed bytes, and move the ones
+   * that follow them by the difference in size.
+   */
+  virtual void edit(std::size_t offset, std::size_t removed,
+                    std::size_t inserted)
+      = 0;
+};
+
+template <typename T>
+class ResultTable final : public IncrementalTable
+{
+public:
+  struct Entry
+  {
+    ParseResult<T> result;
+    std::size_t length;
+    // The end of the bytes inspected, past the end of the text when the
+    // parser saw it end.
+    std::size_t reach;
+  };
+
+  [[nodiscard]] const Entry*
+  find(std::size_t offset) const noexcept
+  {
+    auto it = m_entries.find(offset);
+    return it != m_entries.end() ? &it->second : nullptr;
+  }
+
+  void
+  store(std::size_t offset, Entry entry)
+  {
+    m_entries.insert_or_assign(offset, std::move(entry));
+  }
+
+  void
+  edit(std::size_t offset, std::size_t removed, std::size_t inserted) override
+  {
+    auto last = m_entries.lower_bound(offset + removed);
+    for (auto it = m_entries.begin(); it != last;)
+      it = it->second.reach > offset ? m_entries.erase(it) : std::next(it);
+
+    // Offsets keep their order, so the moved entries go back at the end.
+    std::map<std::size_t, Entry> moved{};
+    while (last != m_entries.end())
+      {
+        auto node = m_entries.extract(last++);
+        node.key() = node.key() - removed + inserted;
+        node.mapped().reach = node.mapped().reach - removed + inserted;
+        moved.insert(moved.end(), std::move(node));
+      }
+    m_entries.merge(moved);
+  }
+
+private:
+  std::map<std::size_t, Entry> m_entries{};
+};
+
+} // namespace detail
+
+class Document;
+
+template <typename T>
+[[nodiscard]] Parser<T> incremental(const Parser<T>& p, Document& document,
+                                    std::size_t lookahead = 1);
+
+/**
+ * A text that is parsed again after each edit, reusing the results of the
+ * incremental() parsers that did not look at the edited bytes, so that the
+ * work done is proportional to the edit rather than to the text.
+ *
+ * A document is not synchronized: parsers that use the same document must
+ * not run concurrently.
+ */
+class Document
+{
+public:
+  explicit Document(std::string text) : m_text{ std::move(text) } {}
+
+  Document(const Document&) = delete;
+  Document& operator=(const Document&) = delete;
+
+  [[nodiscard]] std::string_view
+  text() const noexcept
+  {
+    return m_text;
+  }
+
+  /**
+   * Replace the removed bytes at offset with inserted.
+   */
+  void
+  edit(std::size_t offset, std::size_t removed, std::string_view inserted)
+  {
+    offset = std::min(offset, m_text.size());
+    removed = std::min(removed, m_text.size() - offset);
+    m_text.replace(offset, removed, inserted);
+    std::erase_if(m_tables, [&](const auto& weak) {
+      auto table = weak.lock();
+      if (table) table->edit(offset, removed, inserted.size());
+      return !table;
+    });
+  }
+
+  /**
+   * Parse the text with p, which usually is built from incremental()
+   * parsers.
+   */
+  template <typename T>
+  [[nodiscard]] typename Parser<T>::result_type
+  parse(const Parser<T>& p)
+  {
+    m_reused = 0;
+    m_reparsed = 0;
+    m_reach = 0;
+    return p.run(m_text);
+  }
+
+  /**
+   * The number of results reused by the last parse.
+   */
+  [[nodiscard]] std::size_t
+  reused() const noexcept
+  {
+    return m_reused;
+  }
+
+  /**
+   * The number of incremental() parsers run by the last parse.
+   */
+  [[nodiscard]] std::size_t
+  reparsed() const noexcept
+  {
+    return m_reparsed;
+  }
+
+private:
+  template <typename T>
+  friend Parser<T> incremental(const Parser<T>& p, Document& document,
+                               std::size_t lookahead);
+
+  std::string m_text;
+  // The tables of the incremental parsers that are still alive.
+  std::vector<std::weak_ptr<detail::IncrementalTable> > m_tables{};
+  std::size_t m_reach = 0; // The end of the bytes inspected so far.
+  std::size_t m_reused = 0;
+  std::size_t m_reparsed = 0;
+};
+
+/**
+ * Remember the results of p by the offset into document at which it ran,
+ * with the range of bytes it inspected, and reuse them when parsing the
+ * document again after edits that left that range untouched.
+ *
+ * p may inspect up to lookahead bytes past what it consumes; the bytes
+ * inspected by the incremental parsers it is made of are accounted for by
+ * them. A failure may have inspected anything up to the end of the text, so
+ * it is only reused after edits that come before it, and so are the results
+ * of parsers that saw it fail, e.g. a repetition that it ended.
+ *
+ * Results outlive the text they were parsed from, so T must not refer to
+ * it, e.g. hold a std::string rather than a std::string_view. The returned
+ * parser refers to document, which has to outlive it, and runs p directly
+ * over any other input. Its results are dropped along with it and its
+ * copies.
+ */
+template <typename T>
+[[nodiscard]] Parser<T>
+incremental(const Parser<T>& p, Document& document, std::size_t lookahead)
+{
+  using result_type = typename Parser<T>::result_type;
+  auto table = std::make_shared<detail::ResultTable<T> >();
+  std::erase_if(document.m_tables,
+                [](const auto& weak) { return weak.expired(); });
+  document.m_tables.push_back(table);
+
+  return Parser<T>(
+      p.getLabel(),
+      [p, table, lookahead, &document](std::string_view input) -> result_type {
+        std::string_view text = document.m_text;
+        if (input.data() < text.data()
+            || input.data() + input.size() != text.data() + text.size())
+          return p.run(input);
+
+        std::size_t start = text.size() - input.size();
+        if (auto* entry = table->find(start); entry)
+          {
+            document.m_reach = std::max(document.m_reach, entry->reach);
+            document.m_reused++;
+            if (entry->result.isFailure()) return entry->result.asError();
+            return make_success(T(entry->result.value()),
+                                input.substr(entry->length));
+          }
+
+        auto outer = std::exchange(document.m_reach, 0);
+        auto result = p.run(input);
+        std::size_t length
+            = result.isSuccess() ? input.size() - result.value().second.size()
+                                 : 0;
+        auto reach = std::max(document.m_reach,
+                              result.isSuccess() ? start + length + lookahead
+                                                 : text.size() + 1);
+        document.m_reach = std::max(outer, reach);
+        document.m_reparsed++;
+
+        // Reaching the depth limit depends on what encloses p, e.g. after
+        // an edit, so it is not kept.
+        if (result.isFatal()) return result;
+        if (result.isFailure())
+          table->store(start, { result.asError(), length, reach });
+        else
+          table->store(start, { ParseResult<T>::success(
+                                    T(result.value().first)),
+                                length, reach });
+        return result;
+      });
+}
+
+} // namespace parsec
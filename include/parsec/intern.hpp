@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A string interned in a symbol table. Symbols from the same table compare
+ * by id, and their name stays valid for as long as the table lives.
+ */
+struct Symbol
+{
+  std::uint32_t id;
+  std::string_view name;
+
+  [[nodiscard]] constexpr bool
+  operator==(const Symbol& other) const noexcept
+  {
+    return id == other.id;
+  }
+};
+
+namespace detail
+{
+
+/**
+ * A mutex that does nothing, for tables that are not shared across threads.
+ */
+struct NullMutex
+{
+  void
+  lock() noexcept
+  {
+  }
+
+  void
+  unlock() noexcept
+  {
+  }
+
+  void
+  lock_shared() noexcept
+  {
+  }
+
+  void
+  unlock_shared() noexcept
+  {
+  }
+};
+
+} // namespace detail
+
+/**
+ * Maps strings to small, dense integers. Each distinct string is copied into
+ * the table once; looking it up again costs a hash lookup.
+ *
+ * Mutex guards the table: lookups of known strings take a shared lock and
+ * only new strings take an exclusive one.
+ */
+template <typename Mutex>
+class BasicSymbolTable
+{
+public:
+  BasicSymbolTable() = default;
+  BasicSymbolTable(const BasicSymbolTable&) = delete;
+  BasicSymbolTable& operator=(const BasicSymbolTable&) = delete;
+
+  /**
+   * The symbol for name, adding it to the table if it is not there yet.
+   */
+  [[nodiscard]] Symbol
+  intern(std::string_view name)
+  {
+    if (auto symbol = find(name); symbol) return *symbol;
+
+    std::unique_lock lock{ m_mutex };
+    if (auto it = m_ids.find(name); it != m_ids.end())
+      return { it->second, it->first };
+
+    auto stored = m_strings.store(name);
+    auto id = static_cast<std::uint32_t>(m_names.size());
+    m_names.push_back(stored);
+    m_ids.emplace(stored, id);
+    return { id, stored };
+  }
+
+  [[nodiscard]] std::optional<Symbol>
+  find(std::string_view name) const
+  {
+    std::shared_lock lock{ m_mutex };
+    if (auto it = m_ids.find(name); it != m_ids.end())
+      return Symbol{ it->second, it->first };
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::string_view
+  name(std::uint32_t id) const
+  {
+    std::shared_lock lock{ m_mutex };
+    return m_names.at(id);
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    std::shared_lock lock{ m_mutex };
+    return m_names.size();
+  }
+
+private:
+  mutable Mutex m_mutex{};
+  Arena m_strings{};
+  std::vector<std::string_view> m_names{};
+  std::unordered_map<std::string_view, std::uint32_t> m_ids{};
+};
+
+/**
+ * A symbol table for a single thread, e.g. one per parse.
+ */
+using SymbolTable = BasicSymbolTable<detail::NullMutex>;
+
+/**
+ * A symbol table that can be shared by parsers running on several threads.
+ */
+using ConcurrentSymbolTable = BasicSymbolTable<std::shared_mutex>;
+
+/**
+ * Run p and intern the part of the input it consumed in table. The value
+ * produced by p is discarded.
+ */
+template <typename T, typename Mutex>
+[[nodiscard]] Parser<Symbol>
+intern(const Parser<T>& p, BasicSymbolTable<Mutex>& table) noexcept
+{
+  return Parser<Symbol>(
+      p.getLabel(),
+      [p, &table](std::string_view input) -> Parser<Symbol>::result_type {
+        auto result = p.run(input);
+        if (result.isFailure()) return std::move(result).asError();
+        auto remaining = result.value().second;
+        auto name = input.substr(0, input.size() - remaining.size());
+        return make_success(table.intern(name), remaining);
+      });
+}
+
+} // namespace parsec
@@ -0,0 +1,665 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace parsec
+{
+
+namespace detail
+{
+
+/**
+ * Release a node of a graph, such as a grammar, whose nodes refer to each
+ * other through shared pointers. Releasing the last reference to a node
+ * releases the nodes it refers to in turn, which would overflow the stack
+ * for deep graphs, so the nodes released meanwhile are queued instead, and
+ * released one at a time by the outermost call.
+ */
+inline void
+release(std::shared_ptr<const void> node) noexcept
+{
+  thread_local std::vector<std::shared_ptr<const void> >* pending = nullptr;
+  if (pending)
+    {
+      pending->push_back(std::move(node));
+      return;
+    }
+
+  std::vector<std::shared_ptr<const void> > queue{};
+  pending = &queue;
+  node.reset();
+  while (!queue.empty())
+    {
+      auto next = std::move(queue.back());
+      queue.pop_back();
+      next.reset();
+    }
+  pending = nullptr;
+}
+
+} // namespace detail
+
+/**
+ * The intermediate representation of character parsers.
+ *
+ * The combinators that work over a std::string_view attach to the Parser
+ * they return a Node that describes its structure, e.g. a sequence of a
+ * literal and a repetition. Parsers whose structure is unknown, such as the
+ * ones returned by bind, are opaque leaves. optimize() rewrites this graph
+ * and compiles it back into a Parser.
+ */
+namespace ir
+{
+
+enum class Kind
+{
+  Opaque,
+  Predicate,
+  Set,
+  Literal,
+  Sequence,
+  Choice,
+  Repeat,
+  Map,
+  Capture,
+};
+
+struct Node;
+class Compiler;
+
+using NodePtr = std::shared_ptr<const Node>;
+
+/**
+ * Runs a node without producing its value.
+ * @return The remaining input, or std::nullopt if the node does not match.
+ */
+using Skip = std::function<std::optional<std::string_view>(std::string_view)>;
+
+/**
+ * Builds the Parser<T> described by a node, type erased. Nodes are rewritten
+ * by copying them, so a Lower only looks at the node that it is given.
+ */
+using Lower
+    = std::function<std::shared_ptr<const void>(const NodePtr&, Compiler&)>;
+
+/**
+ * A node of the graph. Nodes are immutable once built and shared between
+ * the parsers that contain them.
+ */
+struct Node
+{
+  Kind kind = Kind::Opaque;
+  std::string label{};
+
+  // The type of the value the node produces, or null for nodes that are only
+  // ever skipped, such as the literals made by fusing characters.
+  const std::type_info* type = nullptr;
+
+  std::function<bool(char)> predicate{}; // Predicate
+  std::bitset<256> set{};                // Set
+  std::string literal{};                 // Literal: the text it matches
+  std::string value{};                   // Literal: the value it produces
+  std::vector<NodePtr> children{};
+  std::size_t keep = 0; // Sequence: the child whose value is produced
+  std::size_t min = 0;  // Repeat: the least number of repetitions
+
+  Lower lower{};
+  Skip skip{}; // Opaque
+
+  Node() = default;
+  Node(const Node&) = default;
+  Node& operator=(const Node&) = default;
+
+  ~Node()
+  {
+    for (auto& child : children) detail::release(std::move(child));
+  }
+};
+
+namespace detail
+{
+
+[[nodiscard]] inline std::string
+showChar(unsigned char c)
+{
+  if (c == '\\' || c == '\'' || c == '"' || c == ']' || c == '-')
+    return std::string("\\") + static_cast<char>(c);
+  if (c >= 0x20 && c < 0x7f) return std::string(1, static_cast<char>(c));
+  static constexpr char hex[] = "0123456789abcdef";
+  return std::string("\\x") + hex[c >> 4] + hex[c & 0xf];
+}
+
+[[nodiscard]] inline std::string
+showSet(const std::bitset<256>& set)
+{
+  if (set.count() == 1)
+    for (unsigned c = 0; c < 256; c++)
+      if (set[c]) return "'" + showChar(static_cast<unsigned char>(c)) + "'";
+
+  std::string result = "[";
+  for (unsigned c = 0; c < 256; c++)
+    {
+      if (!set[c]) continue;
+      auto end = c;
+      while (end + 1 < 256 && set[end + 1]) end++;
+      result += showChar(static_cast<unsigned char>(c));
+      if (end > c + 1) result += "-";
+      if (end > c) result += showChar(static_cast<unsigned char>(end));
+      c = end;
+    }
+  return result + "]";
+}
+
+} // namespace detail
+
+/**
+ * Print a node as an s-expression, e.g. (seq 1 "ab" (many [0-9])).
+ */
+[[nodiscard]] inline std::string
+show(const NodePtr& node)
+{
+  auto list = [&](std::string head) {
+    for (const auto& child : node->children) head += " " + show(child);
+    return "(" + head + ")";
+  };
+
+  switch (node->kind)
+    {
+    case Kind::Predicate:
+      return "<" + node->label + ">";
+    case Kind::Set:
+      return detail::showSet(node->set);
+    case Kind::Literal:
+      {
+        std::string result = "\"";
+        for (auto c : node->literal)
+          result += detail::showChar(static_cast<unsigned char>(c));
+        return result + "\"";
+      }
+    case Kind::Sequence:
+      return list("seq " + std::to_string(node->keep));
+    case Kind::Choice:
+      return list("alt");
+    case Kind::Repeat:
+      return list(node->min == 0 ? "many" : "many1");
+    case Kind::Map:
+      return list("map");
+    case Kind::Capture:
+      return list("capture");
+    default:
+      return "<opaque " + node->label + ">";
+    }
+}
+
+/**
+ * The bytes that can start a match of node, or std::nullopt if node may
+ * match the empty string or its structure is unknown.
+ */
+[[nodiscard]] inline std::optional<std::bitset<256> >
+first(const NodePtr& node)
+{
+  switch (node->kind)
+    {
+    case Kind::Set:
+      return node->set;
+    case Kind::Literal:
+      if (node->literal.empty()) return std::nullopt;
+      return std::bitset<256>{}.set(
+          static_cast<unsigned char>(node->literal[0])
+      );
+    case Kind::Sequence:
+    case Kind::Map:
+    case Kind::Capture:
+      return first(node->children[0]);
+    case Kind::Repeat:
+      if (node->min == 0) return std::nullopt;
+      return first(node->children[0]);
+    case Kind::Choice:
+      {
+        std::bitset<256> result{};
+        for (const auto& child : node->children)
+          {
+            auto set = first(child);
+            if (!set) return std::nullopt;
+            result |= *set;
+          }
+        return result;
+      }
+    default:
+      return std::nullopt;
+    }
+}
+
+/**
+ * For each byte, the alternatives of a choice that can start with it, so
+ * that only those are tried. The last entry holds the alternatives that can
+ * match an empty input.
+ */
+class Dispatch
+{
+public:
+  explicit Dispatch(const Node& choice)
+  {
+    for (std::uint32_t i = 0; i < choice.children.size(); i++)
+      {
+        auto set = first(choice.children[i]);
+        for (std::size_t c = 0; c < 256; c++)
+          if (!set || (*set)[c]) m_candidates[c].push_back(i);
+        if (!set) m_candidates[256].push_back(i);
+      }
+  }
+
+  [[nodiscard]] const std::vector<std::uint32_t>&
+  candidates(std::string_view input) const noexcept
+  {
+    if (input.empty()) return m_candidates[256];
+    return m_candidates[static_cast<unsigned char>(input[0])];
+  }
+
+private:
+  std::array<std::vector<std::uint32_t>, 257> m_candidates{};
+};
+
+/**
+ * Compiles nodes into parsers, once per node, so that shared nodes compile
+ * into shared parsers.
+ */
+class Compiler
+{
+public:
+  /**
+   * The Parser<T> of a node that produces a T, type erased.
+   */
+  std::shared_ptr<const void>
+  typed(const NodePtr& node)
+  {
+    if (auto it = m_typed.find(node.get()); it != m_typed.end())
+      return it->second;
+    auto parser = node->lower(node, *this);
+    m_typed.emplace(node.get(), parser);
+    return parser;
+  }
+
+  /**
+   * A function that runs node without producing its value.
+   */
+  std::shared_ptr<const Skip>
+  skip(const NodePtr& node)
+  {
+    if (auto it = m_skips.find(node.get()); it != m_skips.end())
+      return it->second;
+    auto skip = std::make_shared<const Skip>(compile(node));
+    m_skips.emplace(node.get(), skip);
+    return skip;
+  }
+
+private:
+  Skip
+  compile(const NodePtr& node)
+  {
+    switch (node->kind)
+      {
+      case Kind::Predicate:
+        return [predicate = node->predicate](
+                   std::string_view input
+               ) -> std::optional<std::string_view> {
+          if (input.empty() || !predicate(input[0])) return std::nullopt;
+          return input.substr(1);
+        };
+      case Kind::Set:
+        return [set = node->set](
+                   std::string_view input
+               ) -> std::optional<std::string_view> {
+          if (input.empty() || !set[static_cast<unsigned char>(input[0])])
+            return std::nullopt;
+          return input.substr(1);
+        };
+      case Kind::Literal:
+        return [literal = node->literal](
+                   std::string_view input
+               ) -> std::optional<std::string_view> {
+          if (!input.starts_with(literal)) return std::nullopt;
+          return input.substr(literal.size());
+        };
+      case Kind::Sequence:
+        {
+          std::vector<std::shared_ptr<const Skip> > children{};
+          for (const auto& child : node->children)
+            children.push_back(skip(child));
+          return [children](
+                     std::string_view input
+                 ) -> std::optional<std::string_view> {
+            for (const auto& child : children)
+              {
+                auto rest = (*child)(input);
+                if (!rest) return std::nullopt;
+                input = *rest;
+              }
+            return input;
+          };
+        }
+      case Kind::Choice:
+        {
+          std::vector<std::shared_ptr<const Skip> > children{};
+          for (const auto& child : node->children)
+            children.push_back(skip(child));
+          auto dispatch = std::make_shared<const Dispatch>(*node);
+          return [children, dispatch](
+                     std::string_view input
+                 ) -> std::optional<std::string_view> {
+            for (auto i : dispatch->candidates(input))
+              if (auto rest = (*children[i])(input); rest) return rest;
+            return std::nullopt;
+          };
+        }
+      case Kind::Repeat:
+        {
+          const auto& child = node->children[0];
+          if (child->kind == Kind::Set)
+            return [set = child->set, min = node->min](
+                       std::string_view input
+                   ) -> std::optional<std::string_view> {
+              std::size_t i = 0;
+              while (i < input.size()
+                     && set[static_cast<unsigned char>(input[i])])
+                i++;
+              if (i < min) return std::nullopt;
+              return input.substr(i);
+            };
+          return [child = skip(child), min = node->min](
+                     std::string_view input
+                 ) -> std::optional<std::string_view> {
+            std::size_t n = 0;
+            while (auto rest = (*child)(input))
+              {
+                input = *rest;
+                n++;
+              }
+            if (n < min) return std::nullopt;
+            return input;
+          };
+        }
+      case Kind::Map:
+      case Kind::Capture:
+        return [child = skip(node->children[0])](std::string_view input) {
+          return (*child)(input);
+        };
+      default:
+        return node->skip;
+      }
+  }
+
+  std::unordered_map<const Node*, std::shared_ptr<const void> > m_typed{};
+  std::unordered_map<const Node*, std::shared_ptr<const Skip> > m_skips{};
+};
+
+/**
+ * Rewrites a graph into an equivalent one that runs faster:
+ *
+ * - predicates of single characters are tabulated into sets, so that
+ *   repetitions of them become bulk scans over a table;
+ * - nested sequences and choices are flattened;
+ * - runs of characters and literals whose values are discarded are fused
+ *   into a single literal;
+ * - consecutive alternatives that start with a common literal prefix are
+ *   left-factored, so the prefix is only matched once;
+ * - structurally identical nodes are shared, so they compile only once.
+ *
+ * Predicates and the functions given to map are assumed to be pure: a
+ * predicate is evaluated once per byte value, and functions whose value is
+ * discarded are not called at all.
+ */
+class Optimizer
+{
+public:
+  NodePtr
+  rewrite(const NodePtr& node)
+  {
+    if (auto it = m_rewritten.find(node.get()); it != m_rewritten.end())
+      return it->second;
+
+    auto result = std::make_shared<Node>(*node);
+    for (auto& child : result->children) child = rewrite(child);
+
+    NodePtr rewritten{};
+    switch (node->kind)
+      {
+      case Kind::Predicate:
+        result->kind = Kind::Set;
+        for (unsigned c = 0; c < 256; c++)
+          if (node->predicate(static_cast<char>(c))) result->set.set(c);
+        result->predicate = nullptr;
+        rewritten = intern(std::move(result));
+        break;
+      case Kind::Sequence:
+        rewritten = sequence(std::move(result));
+        break;
+      case Kind::Choice:
+        rewritten = choice(std::move(result));
+        break;
+      default:
+        rewritten = intern(std::move(result));
+        break;
+      }
+
+    m_rewritten.emplace(node.get(), rewritten);
+    return rewritten;
+  }
+
+private:
+  static bool
+  isFixed(const NodePtr& node) noexcept
+  {
+    return node->kind == Kind::Literal
+        || (node->kind == Kind::Set && node->set.count() == 1);
+  }
+
+  static std::string
+  fixedText(const NodePtr& node)
+  {
+    if (node->kind == Kind::Literal) return node->literal;
+    for (unsigned c = 0; c < 256; c++)
+      if (node->set[c]) return std::string(1, static_cast<char>(c));
+    return {};
+  }
+
+  NodePtr
+  literal(std::string text)
+  {
+    auto node = std::make_shared<Node>();
+    node->kind = Kind::Literal;
+    node->label = "\"" + text + "\"";
+    node->literal = std::move(text);
+    return intern(std::move(node));
+  }
+
+  NodePtr
+  sequence(std::shared_ptr<Node> node)
+  {
+    std::vector<NodePtr> flat{};
+    std::size_t keep = 0;
+    for (std::size_t i = 0; i < node->children.size(); i++)
+      {
+        const auto& child = node->children[i];
+        if (child->kind == Kind::Sequence)
+          {
+            if (i == node->keep) keep = flat.size() + child->keep;
+            flat.insert(flat.end(), child->children.begin(),
+                        child->children.end());
+            continue;
+          }
+        if (i == node->keep) keep = flat.size();
+        flat.push_back(child);
+      }
+
+    std::vector<NodePtr> fused{};
+    std::size_t fusedKeep = 0;
+    for (std::size_t i = 0; i < flat.size();)
+      {
+        if (i == keep || !isFixed(flat[i]))
+          {
+            if (i == keep) fusedKeep = fused.size();
+            fused.push_back(flat[i++]);
+            continue;
+          }
+        std::string text{};
+        auto start = i;
+        while (i < flat.size() && i != keep && isFixed(flat[i]))
+          text += fixedText(flat[i++]);
+        if (text.empty()) continue;
+        if (i - start == 1)
+          fused.push_back(flat[start]);
+        else
+          fused.push_back(literal(std::move(text)));
+      }
+
+    if (fused.size() == 1) return fused[0];
+    node->children = std::move(fused);
+    node->keep = fusedKeep;
+    return intern(std::move(node));
+  }
+
+  // The literal that a choice alternative starts with, if its value does not
+  // depend on it.
+  static std::string_view
+  prefix(const NodePtr& node) noexcept
+  {
+    if (node->kind == Kind::Literal) return node->literal;
+    if (node->kind == Kind::Sequence && node->keep != 0
+        && node->children[0]->kind == Kind::Literal)
+      return node->children[0]->literal;
+    return {};
+  }
+
+  // An alternative without the first n characters of its prefix.
+  NodePtr
+  strip(const NodePtr& node, std::size_t n)
+  {
+    auto result = std::make_shared<Node>(*node);
+    if (node->kind == Kind::Literal)
+      {
+        result->literal = node->literal.substr(n);
+        return intern(std::move(result));
+      }
+
+    auto head = node->children[0]->literal.substr(n);
+    if (head.empty())
+      {
+        result->children.erase(result->children.begin());
+        result->keep--;
+        if (result->children.size() == 1) return result->children[0];
+      }
+    else
+      result->children[0] = literal(std::move(head));
+    return intern(std::move(result));
+  }
+
+  NodePtr
+  choice(std::shared_ptr<Node> node)
+  {
+    std::vector<NodePtr> flat{};
+    for (const auto& child : node->children)
+      if (child->kind == Kind::Choice)
+        flat.insert(flat.end(), child->children.begin(),
+                    child->children.end());
+      else
+        flat.push_back(child);
+
+    std::vector<NodePtr> factored{};
+    for (std::size_t i = 0; i < flat.size();)
+      {
+        auto common = prefix(flat[i]);
+        auto j = i + 1;
+        for (; !common.empty() && j < flat.size(); j++)
+          {
+            auto next = prefix(flat[j]);
+            if (next.empty() || next[0] != common[0]) break;
+            std::size_t n = 0;
+            while (n < common.size() && n < next.size()
+                   && common[n] == next[n])
+              n++;
+            common = common.substr(0, n);
+          }
+
+        if (j - i < 2)
+          {
+            factored.push_back(flat[i++]);
+            continue;
+          }
+
+        auto rest = std::make_shared<Node>(*node);
+        rest->children.clear();
+        for (; i < j; i++)
+          rest->children.push_back(strip(flat[i], common.size()));
+
+        auto seq = std::make_shared<Node>(*node);
+        seq->kind = Kind::Sequence;
+        seq->children = { literal(std::string(common)),
+                          choice(std::move(rest)) };
+        seq->keep = 1;
+        factored.push_back(intern(std::move(seq)));
+      }
+
+    if (factored.size() == 1) return factored[0];
+    node->children = std::move(factored);
+    return intern(std::move(node));
+  }
+
+  // Share structurally identical nodes. Opaque nodes and maps hold functions
+  // that cannot be compared, so they are only identical to themselves.
+  NodePtr
+  intern(std::shared_ptr<Node> node)
+  {
+    std::string key = std::to_string(static_cast<int>(node->kind)) + "|"
+                    + (node->type ? node->type->name() : "") + "|";
+    switch (node->kind)
+      {
+      case Kind::Set:
+        key += node->set.to_string();
+        break;
+      case Kind::Literal:
+        key += node->literal + "|" + node->value;
+        break;
+      case Kind::Opaque:
+      case Kind::Predicate:
+      case Kind::Map:
+        return node;
+      default:
+        key += std::to_string(node->keep) + "|" + std::to_string(node->min);
+        break;
+      }
+    for (const auto& child : node->children)
+      key += "|"
+           + std::to_string(reinterpret_cast<std::uintptr_t>(child.get()));
+
+    auto [it, inserted] = m_interned.try_emplace(std::move(key), node);
+    return it->second;
+  }
+
+  std::unordered_map<const Node*, NodePtr> m_rewritten{};
+  std::unordered_map<std::string, NodePtr> m_interned{};
+};
+
+/**
+ * Rewrite the graph rooted at node, see Optimizer.
+ */
+[[nodiscard]] inline NodePtr
+optimize(const NodePtr& node)
+{
+  return Optimizer{}.rewrite(node);
+}
+
+} // namespace ir
+
+} // namespace parsec
@@ -0,0 +1,868 @@
+#pragma once
+
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+namespace json
+{
+
+enum class Type : std::uint8_t
+{
+  Null,
+  Bool,
+  Integer,
+  Double,
+  String,
+  Array,
+  Object,
+};
+
+/**
+ * An entry of the tape a Document is made of.
+ *
+ * Values are laid out in document order. Arrays and objects are followed by
+ * their children (objects alternate keys and values) and record the index one
+ * past their last descendant, so whole subtrees can be skipped in one step.
+ */
+struct Node
+{
+  Type type;
+
+  // Length of a string, or number of children of an array or object.
+  std::uint32_t length;
+
+  // Index one past the last node of the subtree rooted at this node.
+  std::uint32_t end;
+
+  union
+  {
+    bool boolean;
+    std::int64_t integer;
+    double number;
+    const char* string;
+  };
+};
+
+class Value;
+
+/**
+ * A parsed JSON text, stored as a flat tape of nodes.
+ *
+ * Strings without escape sequences point into the parsed input, which
+ * therefore has to outlive the Document.
+ */
+class Document
+{
+public:
+  [[nodiscard]] Value root() const noexcept;
+
+  [[nodiscard]] bool
+  empty() const noexcept
+  {
+    return m_tape.empty();
+  }
+
+  /**
+   * Forget all values but keep the memory around for the next parse.
+   */
+  void
+  clear() noexcept
+  {
+    m_tape.clear();
+    m_strings.clear();
+  }
+
+private:
+  friend class Reader;
+  friend class Value;
+
+  std::uint32_t
+  push(Node node)
+  {
+    auto index = static_cast<std::uint32_t>(m_tape.size());
+    node.end = index + 1;
+    m_tape.push_back(node);
+    return index;
+  }
+
+  std::uint32_t
+  open(Type type)
+  {
+    Node node{};
+    node.type = type;
+    return push(node);
+  }
+
+  std::uint32_t
+  close(std::uint32_t index, std::size_t length) noexcept
+  {
+    m_tape[index].length = static_cast<std::uint32_t>(length);
+    m_tape[index].end = static_cast<std::uint32_t>(m_tape.size());
+    return index;
+  }
+
+  void
+  truncate(std::size_t size) noexcept
+  {
+    m_tape.resize(size);
+  }
+
+  std::vector<Node> m_tape{};
+  Arena m_strings{};
+};
+
+struct Member;
+
+/**
+ * A cheap handle to a value inside a Document.
+ */
+class Value
+{
+public:
+  constexpr Value(const Document& document, std::uint32_t index) noexcept
+      : m_document{ &document }, m_index{ index }
+  {
+  }
+
+  [[nodiscard]] Type
+  type() const noexcept
+  {
+    return node().type;
+  }
+
+  [[nodiscard]] bool
+  isNull() const noexcept
+  {
+    return type() == Type::Null;
+  }
+
+  [[nodiscard]] bool
+  isBool() const noexcept
+  {
+    return type() == Type::Bool;
+  }
+
+  [[nodiscard]] bool
+  isString() const noexcept
+  {
+    return type() == Type::String;
+  }
+
+  [[nodiscard]] bool
+  isArray() const noexcept
+  {
+    return type() == Type::Array;
+  }
+
+  [[nodiscard]] bool
+  isObject() const noexcept
+  {
+    return type() == Type::Object;
+  }
+
+  [[nodiscard]] bool
+  isNumber() const noexcept
+  {
+    return type() == Type::Integer || type() == Type::Double;
+  }
+
+  [[nodiscard]] bool
+  asBool() const noexcept
+  {
+    assert(isBool());
+    return node().boolean;
+  }
+
+  [[nodiscard]] std::int64_t
+  asInteger() const noexcept
+  {
+    assert(type() == Type::Integer);
+    return node().integer;
+  }
+
+  [[nodiscard]] double
+  asDouble() const noexcept
+  {
+    assert(isNumber());
+    if (type() == Type::Integer) return static_cast<double>(node().integer);
+    return node().number;
+  }
+
+  [[nodiscard]] std::string_view
+  asString() const noexcept
+  {
+    assert(isString());
+    return { node().string, node().length };
+  }
+
+  /**
+   * Number of elements of an array or members of an object.
+   */
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    assert(isArray() || isObject());
+    return node().length;
+  }
+
+  /**
+   * The i-th element of an array.
+   */
+  [[nodiscard]] Value
+  operator[](std::size_t i) const
+  {
+    assert(isArray());
+    if (i >= size()) throw std::out_of_range("json array index");
+    auto index = m_index + 1;
+    for (; i > 0; i--) index = m_document->m_tape[index].end;
+    return { *m_document, index };
+  }
+
+  /**
+   * The value of the member of an object with the given key, if any.
+   */
+  [[nodiscard]] std::optional<Value> find(std::string_view key) const;
+
+  [[nodiscard]] Value
+  operator[](std::string_view key) const
+  {
+    if (auto value = find(key); value) return *value;
+    throw std::out_of_range("json object key");
+  }
+
+  template <typename Item>
+  class Children;
+
+  [[nodiscard]] Children<Value> elements() const noexcept;
+  [[nodiscard]] Children<Member> members() const noexcept;
+
+  /**
+   * Serialize this value back to compact JSON.
+   */
+  [[nodiscard]] std::string
+  toString() const
+  {
+    std::string out{};
+    write(out);
+    return out;
+  }
+
+private:
+  friend class Document;
+
+  [[nodiscard]] const Node&
+  node() const noexcept
+  {
+    return m_document->m_tape[m_index];
+  }
+
+  void write(std::string& out) const;
+
+  const Document* m_document;
+  std::uint32_t m_index;
+};
+
+struct Member
+{
+  std::string_view key;
+  Value value;
+};
+
+/**
+ * The elements of an array or the members of an object, walked in document
+ * order without materializing them.
+ */
+template <typename Item>
+class Value::Children
+{
+public:
+  class iterator
+  {
+  public:
+    [[nodiscard]] Item
+    operator*() const noexcept
+    {
+      if constexpr (std::is_same_v<Item, Member>)
+        return Member{ Value{ *m_document, m_index }.asString(),
+                       Value{ *m_document, m_index + 1 } };
+      else
+        return Value{ *m_document, m_index };
+    }
+
+    iterator&
+    operator++() noexcept
+    {
+      if constexpr (std::is_same_v<Item, Member>)
+        m_index = m_document->m_tape[m_index + 1].end;
+      else
+        m_index = m_document->m_tape[m_index].end;
+      return *this;
+    }
+
+    [[nodiscard]] bool
+    operator==(const iterator& other) const noexcept
+    {
+      return m_index == other.m_index;
+    }
+
+  private:
+    friend class Children;
+
+    iterator(const Document& document, std::uint32_t index) noexcept
+        : m_document{ &document }, m_index{ index }
+    {
+    }
+
+    const Document* m_document;
+    std::uint32_t m_index;
+  };
+
+  [[nodiscard]] iterator
+  begin() const noexcept
+  {
+    return { *m_document, m_parent + 1 };
+  }
+
+  [[nodiscard]] iterator
+  end() const noexcept
+  {
+    return { *m_document, m_document->m_tape[m_parent].end };
+  }
+
+private:
+  friend class Value;
+
+  Children(const Document& document, std::uint32_t parent) noexcept
+      : m_document{ &document }, m_parent{ parent }
+  {
+  }
+
+  const Document* m_document;
+  std::uint32_t m_parent;
+};
+
+inline Value
+Document::root() const noexcept
+{
+  assert(!empty());
+  return { *this, 0 };
+}
+
+inline Value::Children<Value>
+Value::elements() const noexcept
+{
+  assert(isArray());
+  return { *m_document, m_index };
+}
+
+inline Value::Children<Member>
+Value::members() const noexcept
+{
+  assert(isObject());
+  return { *m_document, m_index };
+}
+
+inline std::optional<Value>
+Value::find(std::string_view key) const
+{
+  assert(isObject());
+  for (auto member : members())
+    if (member.key == key) return member.value;
+  return std::nullopt;
+}
+
+namespace detail
+{
+
+static inline void
+writeString(std::string& out, std::string_view s)
+{
+  static constexpr char hex[] = "0123456789abcdef";
+  out += '"';
+  for (char c : s)
+    {
+      switch (c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20)
+            {
+              out += "\\u00";
+              out += hex[(c >> 4) & 0xf];
+              out += hex[c & 0xf];
+            }
+          else
+            out += c;
+        }
+    }
+  out += '"';
+}
+
+} // namespace detail
+
+inline void
+Value::write(std::string& out) const
+{
+  switch (type())
+    {
+    case Type::Null: out += "null"; break;
+    case Type::Bool: out += asBool() ? "true" : "false"; break;
+    case Type::Integer: out += std::to_string(asInteger()); break;
+    case Type::Double:
+      {
+        char buffer[32];
+        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer),
+                                       asDouble());
+        out.append(buffer, end);
+        break;
+      }
+    case Type::String: detail::writeString(out, asString()); break;
+    case Type::Array:
+      {
+        out += '[';
+        bool first = true;
+        for (auto element : elements())
+          {
+            if (!first) out += ',';
+            element.write(out);
+            first = false;
+          }
+        out += ']';
+        break;
+      }
+    case Type::Object:
+      {
+        out += '{';
+        bool first = true;
+        for (auto [key, value] : members())
+          {
+            if (!first) out += ',';
+            first = false;
+            detail::writeString(out, key);
+            out += ':';
+            value.write(out);
+          }
+        out += '}';
+        break;
+      }
+    }
+}
+
+namespace detail
+{
+
+[[nodiscard]] constexpr bool
+isSpace(char c) noexcept
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+[[nodiscard]] constexpr bool
+isDigit(char c) noexcept
+{
+  return c >= '0' && c <= '9';
+}
+
+/**
+ * Skip JSON whitespace.
+ */
+static inline Parser<std::string_view>
+whitespace()
+{
+  return Parser<std::string_view>(
+      "whitespace",
+      [](std::string_view input) -> Parser<std::string_view>::result_type {
+        std::size_t i = 0;
+        while (i < input.size() && isSpace(input[i])) i++;
+        return make_success(input.substr(0, i), input.substr(i));
+      });
+}
+
+[[nodiscard]] constexpr int
+hexValue(char c) noexcept
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+[[nodiscard]] static inline std::optional<std::uint32_t>
+hex4(std::string_view s) noexcept
+{
+  if (s.size() < 4) return std::nullopt;
+  std::uint32_t result = 0;
+  for (std::size_t i = 0; i < 4; i++)
+    {
+      auto digit = hexValue(s[i]);
+      if (digit < 0) return std::nullopt;
+      result = (result << 4) | static_cast<std::uint32_t>(digit);
+    }
+  return result;
+}
+
+static inline char*
+encodeUtf8(char* out, std::uint32_t cp) noexcept
+{
+  if (cp < 0x80)
+    *out++ = static_cast<char>(cp);
+  else if (cp < 0x800)
+    {
+      *out++ = static_cast<char>(0xc0 | (cp >> 6));
+      *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    }
+  else if (cp < 0x10000)
+    {
+      *out++ = static_cast<char>(0xe0 | (cp >> 12));
+      *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    }
+  else
+    {
+      *out++ = static_cast<char>(0xf0 | (cp >> 18));
+      *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+      *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    }
+  return out;
+}
+
+/**
+ * Decode the escaped body of a string literal into the arena. An escape
+ * sequence is never shorter than its decoded form, so the body length bounds
+ * the output.
+ */
+[[nodiscard]] static inline std::optional<std::string_view>
+unescape(std::string_view body, Arena& arena)
+{
+  auto begin = arena.allocate(body.size());
+  auto out = begin;
+  for (std::size_t i = 0; i < body.size(); i++)
+    {
+      if (body[i] != '\\')
+        {
+          *out++ = body[i];
+          continue;
+        }
+
+      if (++i == body.size()) return std::nullopt;
+      switch (body[i])
+        {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '/': *out++ = '/'; break;
+        case 'b': *out++ = '\b'; break;
+        case 'f': *out++ = '\f'; break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        case 't': *out++ = '\t'; break;
+        case 'u':
+          {
+            auto cp = hex4(body.substr(i + 1));
+            if (!cp) return std::nullopt;
+            i += 4;
+            if (*cp >= 0xd800 && *cp < 0xdc00)
+              {
+                if (body.substr(i + 1, 2) != "\\u") return std::nullopt;
+                auto low = hex4(body.substr(i + 3));
+                if (!low || *low < 0xdc00 || *low >= 0xe000)
+                  return std::nullopt;
+                cp = 0x10000 + ((*cp - 0xd800) << 10) + (*low - 0xdc00);
+                i += 6;
+              }
+            else if (*cp >= 0xdc00 && *cp < 0xe000)
+              return std::nullopt;
+            out = encodeUtf8(out, *cp);
+            break;
+          }
+        default: return std::nullopt;
+        }
+    }
+  return std::string_view(begin, static_cast<std::size_t>(out - begin));
+}
+
+/**
+ * Parse a string literal. The result points into the input unless the
+ * literal contains escape sequences, in which case it is decoded into the
+ * arena.
+ */
+static inline Parser<std::string_view>
+stringLiteral(Arena& arena)
+{
+  return Parser<std::string_view>(
+      "json string",
+      [&arena](
+          std::string_view input
+      ) -> Parser<std::string_view>::result_type {
+        if (input.empty() || input[0] != '"')
+          return ParserError::create("json string", "Expected '\"'");
+
+        bool escaped = false;
+        for (std::size_t i = 1; i < input.size(); i++)
+          {
+            auto c = input[i];
+            if (c == '"')
+              {
+                auto body = input.substr(1, i - 1);
+                auto rest = input.substr(i + 1);
+                if (!escaped) return make_success(body, rest);
+                if (auto decoded = unescape(body, arena); decoded)
+                  return make_success(*decoded, rest);
+                return ParserError::create("json string",
+                                           "Invalid escape sequence");
+              }
+            if (c == '\\')
+              {
+                escaped = true;
+                i++;
+              }
+            else if (static_cast<unsigned char>(c) < 0x20)
+              return ParserError::create("json string",
+                                         "Unescaped control character");
+          }
+        return ParserError::create("json string", "Unterminated string");
+      });
+}
+
+/**
+ * Parse a number. Integers that fit in 64 bits are kept exact, anything else
+ * is decoded as a double.
+ */
+static inline Parser<Node>
+number()
+{
+  return Parser<Node>(
+      "json number", [](std::string_view input) -> Parser<Node>::result_type {
+        std::size_t i = 0;
+        auto digits = [&] {
+          auto start = i;
+          while (i < input.size() && isDigit(input[i])) i++;
+          return i > start;
+        };
+
+        if (i < input.size() && input[i] == '-') i++;
+        if (i < input.size() && input[i] == '0')
+          i++;
+        else if (!digits())
+          return ParserError::create("json number", "Expected a digit");
+
+        bool integral = true;
+        if (i < input.size() && input[i] == '.')
+          {
+            i++;
+            integral = false;
+            if (!digits())
+              return ParserError::create("json number", "Expected a digit");
+          }
+        if (i < input.size() && (input[i] == 'e' || input[i] == 'E'))
+          {
+            i++;
+            integral = false;
+            if (i < input.size() && (input[i] == '+' || input[i] == '-')) i++;
+            if (!digits())
+              return ParserError::create("json number", "Expected a digit");
+          }
+
+        auto first = input.data();
+        auto last = first + i;
+        Node node{};
+        if (integral)
+          {
+            node.type = Type::Integer;
+            auto [end, ec] = std::from_chars(first, last, node.integer);
+            if (ec == std::errc{}) return make_success(node, input.substr(i));
+          }
+        node.type = Type::Double;
+        auto [end, ec] = std::from_chars(first, last, node.number);
+        if (ec != std::errc{})
+          return ParserError::create("json number", "Number out of range");
+        return make_success(node, input.substr(i));
+      });
+}
+
+} // namespace detail
+
+/**
+ * Parses JSON texts into a Document.
+ *
+ * The grammar is built once, out of parsec combinators, when the Reader is
+ * constructed, and the Document's memory is reused from one parse to the
+ * next. A Reader can be neither copied nor moved, since its grammar refers to
+ * its Document.
+ */
+class Reader
+{
+public:
+  explicit Reader(std::size_t maxDepth = 1024)
+      : m_maxDepth{ maxDepth }
+  {
+    auto ws = detail::whitespace();
+    auto token = [ws](char c) {
+      return charP(c) < ws;
+    };
+    auto value = Parser<std::uint32_t>(
+        "json value",
+        [this](std::string_view input) {
+          return m_value.run(input);
+        });
+
+    auto string = detail::stringLiteral(m_document.m_strings)
+                & [this](std::string_view s) {
+                    Node node{};
+                    node.type = Type::String;
+                    node.string = s.data();
+                    node.length = static_cast<std::uint32_t>(s.length());
+                    return m_document.push(node);
+                  };
+
+    auto number = detail::number() & [this](Node node) {
+      return m_document.push(node);
+    };
+
+    auto boolean = [this](bool b) {
+      return [this, b](const std::string&) {
+        Node node{};
+        node.type = Type::Bool;
+        node.boolean = b;
+        return m_document.push(node);
+      };
+    };
+    auto trueP = stringP("true") & boolean(true);
+    auto falseP = stringP("false") & boolean(false);
+    auto nullP = stringP("null") & [this](const std::string&) {
+      return m_document.open(Type::Null);
+    };
+
+    auto close = [this](std::uint32_t index, std::size_t n, char) {
+      return m_document.close(index, n);
+    };
+
+    auto openArray = token('[') & [this](char) {
+      return m_document.open(Type::Array);
+    };
+    auto array = seq(openArray, skipSepBy(value < ws, token(',')), charP(']'))
+                     .apply(close);
+
+    auto member = string < ws < token(':') > value < ws;
+    auto openObject = token('{') & [this](char) {
+      return m_document.open(Type::Object);
+    };
+    auto object = seq(openObject, skipSepBy(member, token(',')), charP('}'))
+                      .apply(close);
+
+    m_value = Parser<std::uint32_t>(
+        "json value",
+        [=, this](
+            std::string_view input
+        ) -> Parser<std::uint32_t>::result_type {
+          if (input.empty())
+            return ParserError::create("json value", "Empty input!");
+
+          auto mark = m_document.m_tape.size();
+          auto result = [&]() -> Parser<std::uint32_t>::result_type {
+            switch (input[0])
+              {
+              case '{': return nested(object, input);
+              case '[': return nested(array, input);
+              case '"': return string.run(input);
+              case 't': return trueP.run(input);
+              case 'f': return falseP.run(input);
+              case 'n': return nullP.run(input);
+              default: return number.run(input);
+              }
+          }();
+          if (result.isFailure()) m_document.truncate(mark);
+          return result;
+        });
+    m_documentParser = ws > m_value < ws;
+  }
+
+  Reader(const Reader&) = delete;
+  Reader& operator=(const Reader&) = delete;
+
+  /**
+   * Parse a complete JSON text, replacing the contents of the document. The
+   * returned Value is valid until the next parse.
+   */
+  [[nodiscard]] ParseResult<Value>
+  parse(std::string_view input)
+  {
+    m_document.clear();
+    auto result = m_documentParser.run(input);
+    if (result.isFailure()) return std::move(result).asError();
+    auto [index, remaining] = std::move(result).value();
+    if (!remaining.empty())
+      return ParserError::create("json document", "Trailing characters");
+    return ParseResult<Value>::success(Value{ m_document, index });
+  }
+
+  /**
+   * A parser for a single JSON value, appended to this reader's document, to
+   * embed JSON inside larger grammars.
+   */
+  [[nodiscard]] Parser<Value>
+  value()
+  {
+    return m_value & [this](std::uint32_t index) {
+      return Value{ m_document, index };
+    };
+  }
+
+  [[nodiscard]] const Document&
+  document() const noexcept
+  {
+    return m_document;
+  }
+
+  void
+  clear() noexcept
+  {
+    m_document.clear();
+  }
+
+private:
+  /**
+   * Run the parser for an array or an object one level deeper, so that
+   * adversarial inputs fail instead of overflowing the stack.
+   */
+  Parser<std::uint32_t>::result_type
+  nested(const Parser<std::uint32_t>& p, std::string_view input)
+  {
+    if (m_depth == m_maxDepth)
+      return ParserError::create("json value", "Maximum depth exceeded");
+    m_depth++;
+    auto result = p.run(input);
+    m_depth--;
+    return result;
+  }
+
+  Document m_document{};
+  std::size_t m_maxDepth;
+  std::size_t m_depth = 0;
+  Parser<std::uint32_t> m_value{ [](std::string_view) {
+    return ParserError::create("json value", "Uninitialized reader");
+  } };
+  Parser<std::uint32_t> m_documentParser{ m_value };
+};
+
+} // namespace json
+
+} // namespace parsec
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "automaton.hpp"
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A token produced by a Lexer. The text is a view into the lexed input.
+ */
+struct Token
+{
+  std::uint32_t kind;
+  std::string_view text;
+};
+
+/**
+ * The input of parsers that run over tokens instead of characters.
+ */
+using Tokens = std::span<const Token>;
+
+/**
+ * Splits an input into tokens with a DFA compiled from the patterns of its
+ * rules (see detail::Automaton for their syntax). At each position the rule
+ * that matches the longest prefix wins, and among those the one that comes
+ * first, so keywords should be listed before identifiers.
+ *
+ * Rules of kind Lexer::skip, e.g. whitespace and comments, are matched but
+ * produce no tokens, so the grammar that runs over the tokens never has to
+ * deal with them.
+ */
+class Lexer
+{
+public:
+  static constexpr std::uint32_t skip
+      = std::numeric_limits<std::uint32_t>::max();
+
+  struct Rule
+  {
+    std::uint32_t kind;
+    std::string pattern;
+  };
+
+  /**
+   * @throws ParserError if a pattern is malformed.
+   */
+  explicit Lexer(const std::vector<Rule>& rules)
+      : m_kinds{ kinds(rules) }, m_automaton{ patterns(rules) }
+  {
+  }
+
+  /**
+   * Tokenize input into tokens, reusing its memory.
+   * @return A view of the tokens, or an error with the offset of the first
+   * character that no rule matches.
+   */
+  ParseResult<Tokens>
+  tokenize(std::string_view input, std::vector<Token>& tokens) const
+  {
+    tokens.clear();
+    std::size_t pos = 0;
+    while (pos < input.size())
+      {
+        auto [length, rule] = m_automaton.longest(input.substr(pos));
+        if (rule < 0 || length == 0)
+          return ParserError::create("lexer", "No rule matches at offset "
+                                                  + std::to_string(pos));
+        if (m_kinds[rule] != skip)
+          tokens.push_back({ m_kinds[rule], input.substr(pos, length) });
+        pos += length;
+      }
+    return ParseResult<Tokens>::success(Tokens{ tokens });
+  }
+
+  /**
+   * Tokenize input.
+   */
+  [[nodiscard]] ParseResult<std::vector<Token> >
+  tokenize(std::string_view input) const
+  {
+    std::vector<Token> tokens{};
+    auto result = tokenize(input, tokens);
+    if (result.isFailure()) return std::move(result).asError();
+    return ParseResult<std::vector<Token> >::success(std::move(tokens));
+  }
+
+private:
+  static std::vector<std::uint32_t>
+  kinds(const std::vector<Rule>& rules)
+  {
+    std::vector<std::uint32_t> result{};
+    for (const auto& rule : rules) result.push_back(rule.kind);
+    return result;
+  }
+
+  static std::vector<std::string>
+  patterns(const std::vector<Rule>& rules)
+  {
+    std::vector<std::string> result{};
+    for (const auto& rule : rules) result.push_back(rule.pattern);
+    return result;
+  }
+
+  std::vector<std::uint32_t> m_kinds;
+  detail::Automaton m_automaton;
+};
+
+/**
+ * Parse a token of the given kind.
+ */
+static inline Parser<Token, Tokens>
+token(std::uint32_t kind, const std::string& label = "token")
+{
+  return satisfy<Tokens>([kind](const Token& t) { return t.kind == kind; },
+                         label)
+      .withLabel(label);
+}
+
+/**
+ * Parse a token of the given kind whose text is text, e.g. a keyword lexed
+ * as an identifier.
+ */
+static inline Parser<Token, Tokens>
+keyword(std::uint32_t kind, std::string_view text)
+{
+  auto label = std::string(text);
+  return satisfy<Tokens>(
+             [kind, label](const Token& t) {
+               return t.kind == kind && t.text == label;
+             },
+             label)
+      .withLabel(label);
+}
+
+} // namespace parsec
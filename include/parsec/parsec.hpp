@@ -6,15 +6,27 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
+
+#if __has_include(<pthread.h>)
+#include <pthread.h>
+#endif
+
+#include "ir.hpp"
 
 namespace parsec
 {
@@ -28,6 +40,26 @@ public:
     return ParserError{ parser_label, errmsg };
   }
 
+  /**
+   * An error that fails the whole run, such as reaching the depth limit:
+   * combinators pass it on instead of trying another alternative or ending
+   * a repetition.
+   */
+  [[nodiscard]] static ParserError
+  createFatal(const std::string& parser_label,
+              const std::string& errmsg) noexcept
+  {
+    auto error = create(parser_label, errmsg);
+    error.fatal_ = true;
+    return error;
+  }
+
+  [[nodiscard]] bool
+  isFatal() const noexcept
+  {
+    return fatal_;
+  }
+
   [[nodiscard]] std::string
   show() const noexcept
   {
@@ -42,6 +74,7 @@ private:
 
   std::string parser_label_;
   std::string errmsg_;
+  bool fatal_ = false;
 };
 
 template <typename T>
@@ -69,19 +102,45 @@ public:
     return type_ == Failure;
   }
 
-  [[nodiscard]] constexpr T
-  value() const
+  /**
+   * Whether this is a fatal error, which must not be backtracked over. See
+   * ParserError::createFatal.
+   */
+  [[nodiscard]] constexpr bool
+  isFatal() const noexcept
+  {
+    return isFailure() && std::get<ParserError>(value_).isFatal();
+  }
+
+  [[nodiscard]] constexpr const T&
+  value() const&
   {
     if (isFailure()) throw std::get<ParserError>(value_);
     return std::get<T>(value_);
   }
 
+  /**
+   * Move the value out of a result that is about to be discarded.
+   */
+  [[nodiscard]] constexpr T
+  value() &&
+  {
+    if (isFailure()) throw std::get<ParserError>(value_);
+    return std::get<T>(std::move(value_));
+  }
+
   [[nodiscard]] ParserError
-  asError() const
+  asError() const&
   {
     return std::get<ParserError>(value_);
   }
 
+  [[nodiscard]] ParserError
+  asError() &&
+  {
+    return std::get<ParserError>(std::move(value_));
+  }
+
   [[nodiscard]] std::optional<T>
   asOpt() const noexcept
   {
@@ -102,11 +161,11 @@ public:
 
 private:
   constexpr explicit ParseResult(result_type type, T value)
-      : type_{ type }, value_{ value }
+      : type_{ type }, value_{ std::move(value) }
   {
   }
   explicit ParseResult(result_type type, ParserError value)
-      : type_{ type }, value_{ value }
+      : type_{ type }, value_{ std::move(value) }
   {
   }
 
@@ -114,79 +173,558 @@ private:
   std::variant<T, ParserError> value_;
 };
 
-template <typename T>
+/**
+ * The type of the elements of an input stream, e.g. char for a
+ * std::string_view.
+ */
+template <typename Input>
+using input_element_t
+    = std::remove_cvref_t<decltype(std::declval<const Input&>()[0])>;
+
+namespace detail
+{
+
+/**
+ * The input that remains after the first n elements. Inputs are either
+ * string views, which provide substr, or spans, which provide subspan.
+ */
+template <typename Input>
+[[nodiscard]] constexpr Input
+drop(const Input& input, std::size_t n) noexcept
+{
+  if constexpr (requires { input.substr(n); })
+    return input.substr(n);
+  else
+    return input.subspan(n);
+}
+
+/**
+ * The first n elements of input.
+ */
+template <typename Input>
+[[nodiscard]] constexpr Input
+take(const Input& input, std::size_t n) noexcept
+{
+  if constexpr (requires { input.substr(0, n); })
+    return input.substr(0, n);
+  else
+    return input.subspan(0, n);
+}
+
+/**
+ * A label cut short past a limit. Combinators label their parser after the
+ * labels of its parts, which would otherwise grow with the grammar, and
+ * exponentially so when parts are shared.
+ */
+[[nodiscard]] inline std::string
+truncated(const std::string& label)
+{
+  constexpr std::size_t limit = 256;
+  if (label.size() <= limit) return label;
+  return label.substr(0, limit - 3) + "...";
+}
+
+/**
+ * The function that recognizes the input of a parser without producing its
+ * value, compiled on first use and shared by the copies of the parser.
+ */
+struct Recognizer
+{
+  std::once_flag compiled{};
+  std::shared_ptr<const ir::Skip> skip{};
+};
+
+/**
+ * How deeply the parsers running on the calling thread are nested, see
+ * DepthLimit.
+ */
+struct Depth
+{
+  std::size_t level = 0;
+  std::size_t limit = 1024;
+  // The part of the stack of the thread below which nesting stops, leaving
+  // room for the parsers that run between two levels. Empty if unknown.
+  std::uintptr_t bottom = 0;
+  std::uintptr_t floor = 0;
+  bool measured = false;
+};
+
+[[nodiscard]] inline Depth&
+depth() noexcept
+{
+  thread_local Depth state{};
+  return state;
+}
+
+/**
+ * Find the stack of the calling thread, where it is known.
+ */
+inline void
+measureStack(Depth& state) noexcept
+{
+  state.measured = true;
+#if defined(__GLIBC__)
+  pthread_attr_t attributes;
+  if (pthread_getattr_np(pthread_self(), &attributes) != 0) return;
+  void* base = nullptr;
+  std::size_t size = 0;
+  auto found = pthread_attr_getstack(&attributes, &base, &size) == 0;
+  pthread_attr_destroy(&attributes);
+  if (!found) return;
+
+  // Stacks grow down. A quarter of a small stack, e.g. of a worker thread,
+  // is kept for the parsers between two levels.
+  state.bottom = reinterpret_cast<std::uintptr_t>(base);
+  state.floor = state.bottom + std::min<std::size_t>(size / 4, 64 << 10);
+#endif
+}
+
+[[nodiscard, gnu::cold, gnu::noinline]] inline ParserError
+tooDeep(const std::string& label)
+{
+  return ParserError::createFatal(label, "Maximum nesting depth exceeded");
+}
+
+/**
+ * Run f one level deeper, or fail with a fatal error once the limit of the
+ * calling thread has been reached or its stack is running out.
+ */
+template <typename F>
+[[nodiscard]] std::invoke_result_t<F&>
+deeper(const std::string& label, F&& f)
+{
+  auto& state = depth();
+  if (!state.measured) [[unlikely]]
+    measureStack(state);
+  // Parsers may run on a stack other than the thread's, e.g. of a fiber,
+  // which is then only limited by the depth.
+  auto here = reinterpret_cast<std::uintptr_t>(__builtin_frame_address(0));
+  if (state.level >= state.limit
+      || (here >= state.bottom && here < state.floor)) [[unlikely]]
+    return tooDeep(label);
+
+  struct Level
+  {
+    Depth& state;
+    explicit Level(Depth& s) noexcept : state{ s } { state.level++; }
+    ~Level() { state.level--; }
+  } level{ state };
+  return f();
+}
+
+} // namespace detail
+
+/**
+ * A Parser consumes a prefix of its Input and produces a value of type T.
+ *
+ * Input defaults to std::string_view, which also serves binary formats since
+ * a char is a byte wide. Any type that provides the std::string_view subset
+ * used by the combinators (empty, size, operator[] and substr) can be used
+ * instead, as well as a std::span, e.g. of the tokens produced by a Lexer.
+ *
+ * A Parser is a handle to an immutable node shared by its copies, so that
+ * combinators, which keep copies of their parsers, build a grammar in time
+ * linear in its size.
+ */
+template <typename T, typename Input = std::string_view>
 class Parser
 {
 public:
-  using result_type = ParseResult<std::pair<T, std::string_view> >;
-  using function_type = std::function<result_type(std::string_view)>;
+  using value_type = T;
+  using input_type = Input;
+  using result_type = ParseResult<std::pair<T, Input> >;
+  using function_type = std::function<result_type(Input)>;
 
   constexpr
-  Parser(const function_type& f)
-      : m_label{ "unknown" }, m_parselet{ f }
+  Parser(function_type f)
+      : m_state{ std::make_shared<const State>("unknown", std::move(f)) }
   {
   }
 
   constexpr
-  Parser(const std::string& label, const function_type& f)
-      : m_label{ label }, m_parselet(f)
+  Parser(const std::string& label, function_type f)
+      : m_state{ std::make_shared<const State>(label, std::move(f)) }
+  {
+  }
+
+  Parser(const std::string& label, function_type f, ir::NodePtr node)
+      : m_state{
+          std::make_shared<const State>(label, std::move(f), std::move(node))
+        }
   {
   }
 
-  constexpr ~Parser() = default;
+  Parser(const Parser&) = default;
+  Parser(Parser&&) noexcept = default;
+
+  Parser&
+  operator=(Parser other) noexcept
+  {
+    std::swap(m_state, other.m_state);
+    return *this;
+  }
+
+  // Grammars can be deep, so their states are released one at a time.
+  ~Parser()
+  {
+    if (m_state) detail::release(std::move(m_state));
+  }
 
   [[nodiscard]] constexpr const std::string&
   getLabel() const noexcept
   {
-    return m_label;
+    return m_state->label;
   }
 
   constexpr Parser&
   withLabel(const std::string& label) noexcept
   {
-    m_label = label;
+    auto state = std::make_shared<const State>(label, *m_state);
+    detail::release(std::exchange(m_state, std::move(state)));
     return *this;
   }
 
+  /**
+   * The structure of this parser, or null if it is unknown. See ir.hpp.
+   */
+  [[nodiscard]] const ir::NodePtr&
+  node() const noexcept
+  {
+    return m_state->node;
+  }
+
   [[nodiscard]] constexpr result_type
-  run(std::string_view input) const noexcept
+  run(Input input) const noexcept
   {
-    return m_parselet(input);
+    return m_state->parselet(input);
   }
 
   [[nodiscard]] constexpr std::optional<T>
-  runOptional(std::string_view input) const noexcept
+  runOptional(Input input) const noexcept
   {
     if (auto result = run(input).asOpt(); result) return result->first;
     return std::nullopt;
   }
 
   [[nodiscard]] constexpr T
-  runThrowing(std::string_view input) const
+  runThrowing(Input input) const
   {
     return run(input).value().first;
   }
 
+  /**
+   * Match a prefix of input like run does, but without producing values:
+   * functions given to map are not called and repetitions build no lists.
+   * Parsers whose structure is unknown, such as those built by bind, still
+   * run as they are, and reaching the DepthLimit in them is a mismatch.
+   * @return The length of the prefix, or std::nullopt if it does not match.
+   */
+  [[nodiscard]] std::optional<std::size_t>
+  recognize(Input input) const
+  {
+    if constexpr (std::is_same_v<Input, std::string_view>)
+      if (const auto& recognizer = m_state->recognizer; recognizer)
+        {
+          std::call_once(recognizer->compiled, [&] {
+            ir::Compiler compiler{};
+            recognizer->skip = compiler.skip(ir::optimize(m_state->node));
+          });
+          try
+            {
+              auto rest = (*recognizer->skip)(input);
+              if (!rest) return std::nullopt;
+              return input.size() - rest->size();
+            }
+          catch (const ParserError& error)
+            {
+              if (!error.isFatal()) throw;
+              return std::nullopt;
+            }
+        }
+
+    auto result = run(input);
+    if (result.isFailure()) return std::nullopt;
+    return input.size() - result.value().second.size();
+  }
+
+  /**
+   * Whether the whole input matches, without producing values.
+   * See recognize().
+   */
+  [[nodiscard]] bool
+  validate(Input input) const
+  {
+    auto length = recognize(input);
+    return length && *length == input.size();
+  }
+
 private:
-  std::string m_label;
-  function_type m_parselet;
+  struct State
+  {
+    State(const std::string& label, function_type f)
+        : label{ detail::truncated(label) }, parselet{ std::move(f) }
+    {
+    }
+
+    State(const std::string& label, function_type f, ir::NodePtr node)
+        : label{ detail::truncated(label) }, parselet{ std::move(f) },
+          node{ std::move(node) }
+    {
+      if (this->node) recognizer = std::make_shared<detail::Recognizer>();
+    }
+
+    // The same parser under another label.
+    State(const std::string& label, const State& other)
+        : label{ detail::truncated(label) }, parselet{ other.parselet },
+          node{ other.node },
+          recognizer{ other.recognizer }
+    {
+    }
+
+    std::string label;
+    function_type parselet;
+    ir::NodePtr node{};
+    std::shared_ptr<detail::Recognizer> recognizer{};
+  };
+
+  std::shared_ptr<const State> m_state;
 };
 
-template <typename T>
+template <typename T, typename Input>
 constexpr auto
-make_success(const T& value, std::string_view input) noexcept
+make_success(T&& value, Input input) noexcept
 {
-  return Parser<T>::result_type::success(std::pair{ value, input });
+  using value_type = std::remove_cvref_t<T>;
+  return Parser<value_type, Input>::result_type::success(
+      std::pair<value_type, Input>{ std::forward<T>(value), input }
+  );
 }
 
+namespace detail
+{
+
 /**
- * Put a value in a Parser context.
+ * Whether combinators describe the parsers they build with an IR node, which
+ * they do for character parsers.
+ */
+template <typename Input>
+inline constexpr bool has_ir = std::is_same_v<Input, std::string_view>;
+
+template <typename T>
+[[nodiscard]] const Parser<T>&
+lowered(ir::Compiler& compiler, const ir::NodePtr& node)
+{
+  return *static_cast<const Parser<T>*>(compiler.typed(node).get());
+}
+
+/**
+ * The node of p, or an opaque node that runs p if its structure is unknown.
+ */
+template <typename T>
+[[nodiscard]] ir::NodePtr
+nodeOf(const Parser<T>& p)
+{
+  if (p.node()) return p.node();
+  auto node = std::make_shared<ir::Node>();
+  node->label = p.getLabel();
+  node->type = &typeid(T);
+  node->lower = [p](const ir::NodePtr&, ir::Compiler&) {
+    return std::make_shared<const Parser<T> >(p);
+  };
+  node->skip = [p](std::string_view input) -> std::optional<std::string_view> {
+    auto result = p.run(input);
+    // A skip cannot return a fatal error, so it throws it to the parser that
+    // runs the skip.
+    if (result.isFatal()) throw std::move(result).asError();
+    if (result.isFailure()) return std::nullopt;
+    return result.value().second;
+  };
+  return node;
+}
+
+/**
+ * Compile a sequence or a choice that produces a T.
+ */
+template <typename T>
+[[nodiscard]] std::shared_ptr<const void>
+lowerNode(const ir::NodePtr& node, ir::Compiler& compiler)
+{
+  using result_type = typename Parser<T>::result_type;
+  auto label = node->label;
+
+  if (node->kind == ir::Kind::Choice)
+    {
+      std::vector<Parser<T> > alternatives{};
+      for (const auto& child : node->children)
+        alternatives.push_back(lowered<T>(compiler, child));
+      auto dispatch = std::make_shared<const ir::Dispatch>(*node);
+      return std::make_shared<const Parser<T> >(
+          label,
+          [alternatives, dispatch, label](
+              std::string_view input
+          ) -> result_type {
+            const auto& candidates = dispatch->candidates(input);
+            if (candidates.empty())
+              return ParserError::create(label, "No alternative matches");
+            for (std::size_t i = 0; i + 1 < candidates.size(); i++)
+              if (auto result = alternatives[candidates[i]].run(input);
+                  result.isSuccess() || result.isFatal())
+                return result;
+            return alternatives[candidates.back()].run(input);
+          },
+          node);
+    }
+
+  struct Step
+  {
+    std::shared_ptr<const ir::Skip> skip;
+    std::string label;
+  };
+
+  std::vector<Step> before{};
+  std::vector<Step> after{};
+  for (std::size_t i = 0; i < node->children.size(); i++)
+    if (i != node->keep)
+      (i < node->keep ? before : after)
+          .push_back({ compiler.skip(node->children[i]),
+                       node->children[i]->label });
+  auto kept = lowered<T>(compiler, node->children[node->keep]);
+
+  return std::make_shared<const Parser<T> >(
+      label,
+      [before, kept, after](std::string_view input) -> result_type {
+        try
+          {
+            for (const auto& [skip, label] : before)
+              {
+                auto rest = (*skip)(input);
+                if (!rest) return ParserError::create(label, "Failed to parse");
+                input = *rest;
+              }
+
+            auto result = kept.run(input);
+            if (result.isFailure()) return result;
+            auto [value, remaining] = std::move(result).value();
+
+            for (const auto& [skip, label] : after)
+              {
+                auto rest = (*skip)(remaining);
+                if (!rest) return ParserError::create(label, "Failed to parse");
+                remaining = *rest;
+              }
+            return make_success(std::move(value), remaining);
+          }
+        catch (const ParserError& error)
+          {
+            if (!error.isFatal()) throw;
+            return error;
+          }
+      },
+      node);
+}
+
+/**
+ * A sequence or a choice node that produces a T.
+ */
+template <typename T>
+[[nodiscard]] ir::NodePtr
+composite(ir::Kind kind,
+          const std::string& label,
+          std::vector<ir::NodePtr> children,
+          std::size_t keep = 0)
+{
+  auto node = std::make_shared<ir::Node>();
+  node->kind = kind;
+  node->label = label;
+  node->type = &typeid(T);
+  node->children = std::move(children);
+  node->keep = keep;
+  node->lower = lowerNode<T>;
+  return node;
+}
+
+/**
+ * Compile a repetition of a parser that produces a T. Repetitions of a set
+ * of characters scan the input with a table lookup per character.
+ */
+template <typename T>
+[[nodiscard]] std::shared_ptr<const void>
+lowerRepeat(const ir::NodePtr& node, ir::Compiler& compiler)
+{
+  using result_type = typename Parser<std::list<T> >::result_type;
+  auto label = node->label;
+  auto min = node->min;
+  const auto& child = node->children[0];
+
+  if constexpr (std::is_same_v<T, char>)
+    if (child->kind == ir::Kind::Set)
+      return std::make_shared<const Parser<std::list<char> > >(
+          label,
+          [set = child->set, min, label](
+              std::string_view input
+          ) -> result_type {
+            std::size_t i = 0;
+            while (i < input.size()
+                   && set[static_cast<unsigned char>(input[i])])
+              i++;
+            if (i < min)
+              return ParserError::create(label, "Failed to parse");
+            return make_success(
+                std::list<char>(input.begin(), input.begin() + i),
+                input.substr(i)
+            );
+          },
+          node);
+
+  auto p = lowered<T>(compiler, child);
+  return std::make_shared<const Parser<std::list<T> > >(
+      label,
+      [p, min](std::string_view input) -> result_type {
+        std::list<T> xs{};
+        while (1)
+          {
+            auto result = p.run(input);
+            if (result.isFailure())
+              {
+                if (xs.size() < min || result.isFatal())
+                  return std::move(result).asError();
+                return make_success(std::move(xs), input);
+              }
+            auto [x, rest] = std::move(result).value();
+            xs.push_back(std::move(x));
+            input = rest;
+          }
+      },
+      node);
+}
+
+/**
+ * A repetition of p, at least min times.
  */
 template <typename T>
+[[nodiscard]] ir::NodePtr
+repeat(std::size_t min, const std::string& label, const Parser<T>& p)
+{
+  auto node = std::make_shared<ir::Node>();
+  node->kind = ir::Kind::Repeat;
+  node->label = label;
+  node->type = &typeid(std::list<T>);
+  node->children = { nodeOf(p) };
+  node->min = min;
+  node->lower = lowerRepeat<T>;
+  return node;
+}
+
+} // namespace detail
+
+/**
+ * Put a value in a Parser context.
+ */
+template <typename Input = std::string_view, typename T>
 [[nodiscard]] constexpr auto
 pure(const T& value)
 {
-  return Parser<T>([value](std::string_view input) {
+  return Parser<T, Input>([value](Input input) {
     return make_success(value, input);
   });
 }
@@ -194,44 +732,62 @@ pure(const T& value)
 /**
  * Function application in the Parser context.
  */
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-ap(const Parser<F>& fP, const Parser<T>& p) noexcept
+ap(const Parser<F, Input>& fP, const Parser<T, Input>& p) noexcept
 {
-  return fP >>= [p](F f) {
-    return p >>= [f](T x) {
-      return pure(f(x));
-    };
-  };
+  using R = std::invoke_result_t<F&, T&&>;
+  return Parser<R, Input>(
+      fP.getLabel() + " applied to " + p.getLabel(),
+      [fP, p](Input input) -> typename Parser<R, Input>::result_type {
+        auto fResult = fP.run(input);
+        if (fResult.isFailure()) return std::move(fResult).asError();
+        auto [f, remaining] = std::move(fResult).value();
+
+        auto result = p.run(remaining);
+        if (result.isFailure()) return std::move(result).asError();
+        auto [x, rest] = std::move(result).value();
+        return make_success(f(std::move(x)), rest);
+      });
 }
 
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-operator*(const Parser<F>& fP, const Parser<T>& p)
+operator*(const Parser<F, Input>& fP, const Parser<T, Input>& p)
 {
   return ap(fP, p);
 }
 
 /**
  * Monadic bind for parsers.
+ *
+ * The parser returned by f is built anew for every value parsed, so prefer
+ * map, ap, seq or the sequencing operators unless the next parser really
+ * depends on the value.
  */
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-bind(const Parser<T>& p, F f) noexcept
+bind(const Parser<T, Input>& p, F f) noexcept
 {
   using result_parser = typename std::result_of<F(T)>::type;
-  return result_parser([f, p](std::string_view input) ->
+  return result_parser([f, p](Input input) ->
                        typename result_parser::result_type {
                          auto result = p.run(input);
-                         if (result.isFailure()) return result.asError();
-                         auto [value, remainingInput] = result.value();
-                         return f(value).run(remainingInput);
+                         if (result.isFailure())
+                           return std::move(result).asError();
+                         auto [value, remainingInput]
+                             = std::move(result).value();
+                         // The next parser nests, see DepthLimit.
+                         auto next = f(std::move(value));
+                         return detail::deeper(next.getLabel(), [&] {
+                           return next.run(remainingInput);
+                         });
                        });
 }
 
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-operator>>=(const Parser<T>& p, F f) noexcept
+operator>>=(const Parser<T, Input>& p, F f) noexcept
 {
   return bind(p, f);
 }
@@ -240,18 +796,44 @@ operator>>=(const Parser<T>& p, F f) noexcept
  * Apply a function to the value inside a Parser and return its result
  * in the Parser context.
  */
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-map(F f, const Parser<T>& p) noexcept
+map(F f, const Parser<T, Input>& p) noexcept
 {
-  return p >>= [f](T value) {
-    return pure(f(value));
+  using R = std::invoke_result_t<F&, T&&>;
+  auto mapped = [](F f, const Parser<T, Input>& p, ir::NodePtr node) {
+    return Parser<R, Input>(
+        p.getLabel(),
+        [f, p](Input input) -> typename Parser<R, Input>::result_type {
+          auto result = p.run(input);
+          if (result.isFailure()) return std::move(result).asError();
+          auto [value, remaining] = std::move(result).value();
+          return make_success(f(std::move(value)), remaining);
+        },
+        std::move(node));
   };
+
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    {
+      auto map = std::make_shared<ir::Node>();
+      map->kind = ir::Kind::Map;
+      map->label = p.getLabel();
+      map->type = &typeid(R);
+      map->children = { detail::nodeOf(p) };
+      map->lower = [f, mapped](const ir::NodePtr& node,
+                               ir::Compiler& compiler) {
+        auto p = detail::lowered<T>(compiler, node->children[0]);
+        return std::make_shared<const Parser<R> >(mapped(f, p, node));
+      };
+      node = std::move(map);
+    }
+  return mapped(f, p, std::move(node));
 }
 
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-operator%(F f, const Parser<T>& p) noexcept
+operator%(F f, const Parser<T, Input>& p) noexcept
 {
   return map(f, p);
 }
@@ -259,50 +841,205 @@ operator%(F f, const Parser<T>& p) noexcept
 /**
  * Reverse functorial application.
  */
-template <typename F, typename T>
+template <typename F, typename T, typename Input>
 [[nodiscard]] constexpr auto
-operator&(const Parser<T>& p, F f) noexcept
+operator&(const Parser<T, Input>& p, F f) noexcept
 {
   return map(f, p);
 }
 
-template <typename T>
+template <typename T, typename Input>
 [[nodiscard]] constexpr auto
-sequence(const std::vector<Parser<T> >& parsers) noexcept
+sequence(const std::vector<Parser<T, Input> >& parsers) noexcept
 {
-  auto parselet = [parsers](std::string_view input) ->
-      typename Parser<std::vector<T> >::result_type {
+  auto parselet = [parsers](Input input) ->
+      typename Parser<std::vector<T>, Input>::result_type {
         std::vector<T> results{};
-        std::string_view remaining = input;
+        Input remaining = input;
 
         for (const auto& parser : parsers)
           {
             auto result = parser.run(remaining);
-            if (result.isFailure()) return result.asError();
-            results.push_back(result.value().first);
-            remaining = result.value().second;
+            if (result.isFailure()) return std::move(result).asError();
+            auto [x, rest] = std::move(result).value();
+            results.push_back(std::move(x));
+            remaining = rest;
           }
 
-        return make_success(results, remaining);
+        return make_success(std::move(results), remaining);
       };
-  return Parser<std::vector<T> >(parselet);
+  return Parser<std::vector<T>, Input>(parselet);
+}
+
+namespace detail
+{
+
+template <typename T, typename... Vs>
+[[nodiscard]] constexpr T
+construct(Vs&&... values)
+{
+  if constexpr (std::is_constructible_v<T, Vs&&...>)
+    return T(std::forward<Vs>(values)...);
+  else
+    return T{ std::forward<Vs>(values)... };
+}
+
+/**
+ * Run the I-th parser of a tuple of parsers and recurse with its value
+ * appended to the values parsed so far. Values are handed down the recursion
+ * and the final call passes them straight to f, so no intermediate parsers or
+ * closures are built while parsing.
+ */
+template <std::size_t I,
+          typename R,
+          typename Input,
+          typename Parsers,
+          typename F,
+          typename... Vs>
+[[nodiscard]] typename Parser<R, Input>::result_type
+runSeq(const Parsers& parsers, Input input, const F& f, Vs&&... values)
+{
+  if constexpr (I == std::tuple_size_v<Parsers>)
+    return make_success<R>(std::invoke(f, std::forward<Vs>(values)...),
+                           input);
+  else
+    {
+      auto result = std::get<I>(parsers).run(input);
+      if (result.isFailure()) return std::move(result).asError();
+      auto [value, remaining] = std::move(result).value();
+      return runSeq<I + 1, R>(
+          parsers, remaining, f, std::forward<Vs>(values)..., std::move(value)
+      );
+    }
+}
+
+} // namespace detail
+
+/**
+ * A fixed sequence of parsers of possibly different types, built with seq.
+ */
+template <typename Input, typename... Ts>
+class Seq
+{
+public:
+  constexpr explicit Seq(const Parser<Ts, Input>&... parsers)
+      : m_parsers{ parsers... }
+  {
+  }
+
+  /**
+   * Run the parsers in order and call f with all their values.
+   */
+  template <typename F>
+  [[nodiscard]] constexpr auto
+  apply(F f) const
+  {
+    using R = std::invoke_result_t<F, Ts&&...>;
+    return Parser<R, Input>(
+        label(),
+        [parsers = m_parsers,
+         f](Input input) -> typename Parser<R, Input>::result_type {
+          return detail::runSeq<0, R>(parsers, input, f);
+        });
+  }
+
+  /**
+   * Run the parsers in order and construct a T from their values, either
+   * through one of its constructors or through aggregate initialization.
+   */
+  template <typename T>
+  [[nodiscard]] constexpr Parser<T, Input>
+  into() const
+  {
+    return apply([](Ts&&... values) {
+      return detail::construct<T>(std::move(values)...);
+    });
+  }
+
+private:
+  [[nodiscard]] std::string
+  label() const
+  {
+    return std::apply(
+        [](const auto& first, const auto&... rest) {
+          return (first.getLabel() + ... + (" and then " + rest.getLabel()));
+        },
+        m_parsers);
+  }
+
+  std::tuple<Parser<Ts, Input>...> m_parsers;
+};
+
+/**
+ * Sequence N parsers, e.g. seq(nameP, ageP).into<Person>().
+ */
+template <typename Input, typename T, typename... Ts>
+[[nodiscard]] constexpr auto
+seq(const Parser<T, Input>& parser, const Parser<Ts, Input>&... parsers)
+{
+  return Seq<Input, T, Ts...>(parser, parsers...);
+}
+
+/**
+ * Run the given parsers in order and construct a T from their values.
+ */
+template <typename T, typename Input, typename... Ts>
+[[nodiscard]] constexpr Parser<T, Input>
+construct(const Parser<Ts, Input>&... parsers)
+{
+  return seq(parsers...).template into<T>();
 }
 
 /**
  * Parses any character that satisfies the given predicate.
+ *
+ * Over an Input other than std::string_view, this parses any single element
+ * of the input that satisfies the predicate.
  */
-template <typename P>
+template <typename Input = std::string_view, typename P>
 [[nodiscard]] auto
 satisfy(P predicate, const std::string& label) noexcept
 {
-  auto parselet = [predicate,
-                   label](std::string_view input) -> Parser<char>::result_type {
-    if (input.empty()) return ParserError::create(label, "Empty input!");
-    if (predicate(input[0])) return make_success(input[0], input.substr(1));
-    return ParserError::create(label,
-                               std::string("Unexpected '") + input[0] + "'");
+  using element_type = input_element_t<Input>;
+  auto parselet = [label](auto predicate) {
+    return [predicate, label](
+               Input input
+           ) -> typename Parser<element_type, Input>::result_type {
+      if (input.empty()) return ParserError::create(label, "Empty input!");
+      if (predicate(input[0]))
+        return make_success(input[0], detail::drop(input, 1));
+      if constexpr (std::is_same_v<element_type, char>)
+        return ParserError::create(label, std::string("Unexpected '")
+                                              + input[0] + "'");
+      else
+        return ParserError::create(label, "Unexpected input");
+    };
   };
-  return Parser<char>(parselet);
+
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    {
+      auto satisfy = std::make_shared<ir::Node>();
+      satisfy->kind = ir::Kind::Predicate;
+      satisfy->label = label;
+      satisfy->type = &typeid(char);
+      satisfy->predicate = [predicate](char c) -> bool {
+        return predicate(c);
+      };
+      // Once optimized, the predicate has been tabulated into a set.
+      satisfy->lower = [parselet](const ir::NodePtr& node, ir::Compiler&) {
+        auto inSet = [set = node->set](char c) {
+          return set[static_cast<unsigned char>(c)];
+        };
+        auto f = node->kind == ir::Kind::Set
+                   ? Parser<char>::function_type(parselet(inSet))
+                   : Parser<char>::function_type(parselet(node->predicate));
+        return std::make_shared<const Parser<char> >(node->label, f, node);
+      };
+      node = std::move(satisfy);
+    }
+  return Parser<element_type, Input>(label, parselet(predicate),
+                                     std::move(node));
 }
 
 /**
@@ -325,13 +1062,31 @@ charP(char charToMatch) noexcept
 stringP(const std::string& s)
 {
   auto label = "string \"" + s + "\"";
-  return Parser<std::string>(
-      label,
-      [s, label](std::string_view input) -> Parser<std::string>::result_type {
-        if (auto pos = input.find(s); pos == 0)
-          return make_success(s, input.substr(pos + s.length()));
-        return ParserError::create(label, "Failed to parse string");
-      });
+  auto parselet = [label](const std::string& literal,
+                          const std::string& value) {
+    return [literal, value, label](
+               std::string_view input
+           ) -> Parser<std::string>::result_type {
+      if (input.starts_with(literal))
+        return make_success(value, input.substr(literal.length()));
+      return ParserError::create(label, "Failed to parse string");
+    };
+  };
+
+  auto node = std::make_shared<ir::Node>();
+  node->kind = ir::Kind::Literal;
+  node->label = label;
+  node->type = &typeid(std::string);
+  node->literal = s;
+  node->value = s;
+  // A literal may have lost a prefix to left-factoring, but still produces
+  // the whole string.
+  node->lower = [parselet](const ir::NodePtr& node, ir::Compiler&) {
+    return std::make_shared<const Parser<std::string> >(
+        node->label, parselet(node->literal, node->value), node
+    );
+  };
+  return Parser<std::string>(label, parselet(s, s), std::move(node));
 }
 
 /**
@@ -355,98 +1110,613 @@ anyOf(Chars&&... chars)
       .withLabel((std::string("any of: ") + ... + chars));
 }
 
-template <typename T>
+template <typename T, typename Input>
 [[nodiscard]] constexpr auto
-many(const Parser<T>& parser) noexcept
+many(const Parser<T, Input>& parser) noexcept
 {
-  return Parser<std::list<T> >(
-      std::string("many of ") + parser.getLabel(),
-      [parser](std::string_view input) {
-        std::string_view remaining = input;
+  auto label = std::string("many of ") + parser.getLabel();
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>) node = detail::repeat(0, label, parser);
+  return Parser<std::list<T>, Input>(
+      label,
+      [parser](Input input) ->
+      typename Parser<std::list<T>, Input>::result_type {
+        Input remaining = input;
         std::list<T> xs{};
         while (1)
           {
             auto result = parser.run(remaining);
+            if (result.isFatal()) return std::move(result).asError();
             if (result.isFailure())
               return make_success(std::move(xs), std::move(remaining));
-            xs.push_back(std::move(result.value().first));
-            remaining = std::move(result.value().second);
+            auto [x, rest] = std::move(result).value();
+            xs.push_back(std::move(x));
+            remaining = rest;
           }
-      });
+      },
+      std::move(node));
 }
 
-template <typename T>
-[[nodiscard]] constexpr Parser<std::list<T> >
-many1(const Parser<T>& parser) noexcept
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+many1(const Parser<T, Input>& parser) noexcept
 {
-  return parser >>= [parser](auto x) {
-    return many(parser) & [x](std::list<T> xs) {
-      xs.push_front(x);
-      return xs;
-    };
-  };
+  auto label = std::string("many1 of ") + parser.getLabel();
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>) node = detail::repeat(1, label, parser);
+  return Parser<std::list<T>, Input>(
+      label,
+      [parser](Input input) ->
+      typename Parser<std::list<T>, Input>::result_type {
+        auto first = parser.run(input);
+        if (first.isFailure()) return std::move(first).asError();
+        auto [x, remaining] = std::move(first).value();
+        std::list<T> xs{};
+        xs.push_back(std::move(x));
+        while (1)
+          {
+            auto result = parser.run(remaining);
+            if (result.isFatal()) return std::move(result).asError();
+            if (result.isFailure())
+              return make_success(std::move(xs), remaining);
+            auto [y, rest] = std::move(result).value();
+            xs.push_back(std::move(y));
+            remaining = rest;
+          }
+      },
+      std::move(node));
 }
 
 /**
  * Run the provided parser and return the provided default
  * value if it fails.
  */
-template <typename T>
-[[nodiscard]] constexpr Parser<T>
-option(const T& def, Parser<T> parser)
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+option(const T& def, Parser<T, Input> parser)
 {
-  return (parser | pure(def))
+  return (parser | pure<Input>(def))
       .withLabel(std::string("Optional ") + parser.getLabel());
 }
 
+/**
+ * Run p and return the part of the input it consumed instead of its value.
+ */
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<Input, Input>
+consumed(const Parser<T, Input>& p) noexcept
+{
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    {
+      auto capture = std::make_shared<ir::Node>();
+      capture->kind = ir::Kind::Capture;
+      capture->label = p.getLabel();
+      capture->type = &typeid(std::string_view);
+      capture->children = { detail::nodeOf(p) };
+      // The value of p is discarded, so it is only skipped.
+      capture->lower = [](const ir::NodePtr& node, ir::Compiler& compiler) {
+        auto skip = compiler.skip(node->children[0]);
+        auto label = node->label;
+        return std::make_shared<const Parser<std::string_view> >(
+            label,
+            [skip, label](
+                std::string_view input
+            ) -> Parser<std::string_view>::result_type {
+              try
+                {
+                  auto rest = (*skip)(input);
+                  if (!rest)
+                    return ParserError::create(label, "Failed to parse");
+                  auto length = input.size() - rest->size();
+                  return make_success(input.substr(0, length), *rest);
+                }
+              catch (const ParserError& error)
+                {
+                  if (!error.isFatal()) throw;
+                  return error;
+                }
+            },
+            node);
+      };
+      node = std::move(capture);
+    }
+
+  return Parser<Input, Input>(
+      p.getLabel(),
+      [p](Input input) -> typename Parser<Input, Input>::result_type {
+        auto result = p.run(input);
+        if (result.isFailure()) return std::move(result).asError();
+        auto remaining = result.value().second;
+        auto length = input.size() - remaining.size();
+        return make_success(detail::take(input, length), remaining);
+      },
+      std::move(node));
+}
+
 /**
  * Applies one or more ocurrences of p, separated by sep.
  * @return A list of the values returned by p.
  */
-template <typename T, typename Sep>
-[[nodiscard]] constexpr Parser<std::list<T> >
-sepBy1(const Parser<T>& p, const Parser<Sep>& sep) noexcept
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+sepBy1(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
 {
-  return (p >>=
-          [p, sep](T x) {
-            return many(sep >> p) & [x](std::list<T> xs) {
-              xs.push_front(x);
-              return xs;
-            };
-          })
-      .withLabel(p.getLabel() + " separated by " + sep.getLabel());
+  using result_type = typename Parser<std::list<T>, Input>::result_type;
+  auto label = p.getLabel() + " separated by " + sep.getLabel();
+  auto parselet = [p, sep](Input input) -> result_type {
+    auto first = p.run(input);
+    if (first.isFailure()) return std::move(first).asError();
+    auto [x, remaining] = std::move(first).value();
+    std::list<T> xs{};
+    xs.push_back(std::move(x));
+    while (1)
+      {
+        auto sepResult = sep.run(remaining);
+        if (sepResult.isFatal()) return std::move(sepResult).asError();
+        if (sepResult.isFailure()) break;
+
+        auto result = p.run(sepResult.value().second);
+        if (result.isFatal()) return std::move(result).asError();
+        if (result.isFailure()) break;
+        auto [y, rest] = std::move(result).value();
+        xs.push_back(std::move(y));
+        remaining = rest;
+      }
+    return make_success(std::move(xs), remaining);
+  };
+
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    {
+      // Described as p followed by many(sep >> p), which matches the same
+      // input, but the list is still built by the parselet.
+      auto step = detail::composite<T>(ir::Kind::Sequence, label,
+                                       { detail::nodeOf(sep),
+                                         detail::nodeOf(p) }, 1);
+      auto rest = std::make_shared<ir::Node>();
+      rest->kind = ir::Kind::Repeat;
+      rest->label = label;
+      rest->type = &typeid(std::list<T>);
+      rest->children = { std::move(step) };
+      rest->lower = detail::lowerRepeat<T>;
+
+      auto list = std::make_shared<ir::Node>();
+      list->kind = ir::Kind::Map;
+      list->label = label;
+      list->type = &typeid(std::list<T>);
+      list->children = { detail::composite<T>(
+          ir::Kind::Sequence, label, { detail::nodeOf(p), std::move(rest) }
+      ) };
+      list->lower = [parselet](const ir::NodePtr& node, ir::Compiler&) {
+        return std::make_shared<const Parser<std::list<T> > >(
+            node->label, parselet, node
+        );
+      };
+      node = std::move(list);
+    }
+  return Parser<std::list<T>, Input>(label, parselet, std::move(node));
 }
 
 /**
  * Applies zero or more ocurrences of p, separated by sep.
  * @return A list of the values returned by p.
  */
-template <typename T, typename Sep>
-[[nodiscard]] constexpr Parser<std::list<T> >
-sepBy(const Parser<T>& p, const Parser<Sep>& sep) noexcept
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+sepBy(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return sepBy1(p, sep) | pure<Input>(std::list<T>{});
+}
+
+/**
+ * Applies zero or more ocurrences of p, discarding their values.
+ * @return The number of ocurrences of p.
+ */
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<std::size_t, Input>
+skipMany(const Parser<T, Input>& p) noexcept
+{
+  return Parser<std::size_t, Input>(
+      std::string("skip many of ") + p.getLabel(),
+      [p](Input input) -> typename Parser<std::size_t, Input>::result_type {
+        Input remaining = input;
+        std::size_t n = 0;
+        while (1)
+          {
+            auto result = p.run(remaining);
+            if (result.isFatal()) return std::move(result).asError();
+            if (result.isFailure()) return make_success(n, remaining);
+            remaining = result.value().second;
+            n++;
+          }
+      });
+}
+
+/**
+ * Applies zero or more ocurrences of p, separated by sep, discarding their
+ * values.
+ * @return The number of ocurrences of p.
+ */
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::size_t, Input>
+skipSepBy(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return Parser<std::size_t, Input>(
+      std::string("skip ") + p.getLabel() + " separated by " + sep.getLabel(),
+      [p, sep](Input input) ->
+      typename Parser<std::size_t, Input>::result_type {
+        auto first = p.run(input);
+        if (first.isFatal()) return std::move(first).asError();
+        if (first.isFailure()) return make_success(std::size_t{ 0 }, input);
+
+        Input remaining = first.value().second;
+        std::size_t n = 1;
+        while (1)
+          {
+            auto sepResult = sep.run(remaining);
+            if (sepResult.isFatal()) return std::move(sepResult).asError();
+            if (sepResult.isFailure()) break;
+
+            auto result = p.run(sepResult.value().second);
+            if (result.isFatal()) return std::move(result).asError();
+            if (result.isFailure()) break;
+            remaining = result.value().second;
+            n++;
+          }
+        return make_success(n, remaining);
+      });
+}
+
+/**
+ * Applies p exactly n times.
+ * @return A vector of the n values returned by p.
+ */
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<std::vector<T>, Input>
+count(std::size_t n, const Parser<T, Input>& p) noexcept
+{
+  return Parser<std::vector<T>, Input>(
+      std::to_string(n) + " of " + p.getLabel(),
+      [n, p](Input input) ->
+      typename Parser<std::vector<T>, Input>::result_type {
+        std::vector<T> xs{};
+        xs.reserve(n);
+        Input remaining = input;
+
+        for (std::size_t i = 0; i < n; i++)
+          {
+            auto result = p.run(remaining);
+            if (result.isFailure()) return std::move(result).asError();
+            auto [x, rest] = std::move(result).value();
+            xs.push_back(std::move(x));
+            remaining = rest;
+          }
+
+        return make_success(std::move(xs), remaining);
+      });
+}
+
+/**
+ * Applies zero or more ocurrences of p until end succeeds.
+ * @return A list of the values returned by p.
+ */
+template <typename T, typename End, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+manyTill(const Parser<T, Input>& p, const Parser<End, Input>& end) noexcept
+{
+  return Parser<std::list<T>, Input>(
+      p.getLabel() + " until " + end.getLabel(),
+      [p, end](Input input) ->
+      typename Parser<std::list<T>, Input>::result_type {
+        Input remaining = input;
+        std::list<T> xs{};
+        while (1)
+          {
+            if (auto result = end.run(remaining); result.isSuccess())
+              return make_success(std::move(xs), result.value().second);
+            else if (result.isFatal())
+              return std::move(result).asError();
+
+            auto result = p.run(remaining);
+            if (result.isFailure()) return std::move(result).asError();
+            auto [x, rest] = std::move(result).value();
+            xs.push_back(std::move(x));
+            remaining = rest;
+          }
+      });
+}
+
+/**
+ * Skips input until end matches, consuming what end matches as well, or
+ * until the input is exhausted. Meant to find the point from which parsing
+ * can resume after an error, e.g. the end of a line.
+ * @return The number of elements skipped before end.
+ */
+template <typename End, typename Input>
+[[nodiscard]] constexpr Parser<std::size_t, Input>
+skipUntil(const Parser<End, Input>& end) noexcept
+{
+  return Parser<std::size_t, Input>(
+      "skip until " + end.getLabel(),
+      [end](Input input) -> typename Parser<std::size_t, Input>::result_type {
+        std::size_t n = 0;
+        for (; n < input.size(); n++)
+          {
+            auto remaining = detail::drop(input, n);
+            if (auto result = end.run(remaining); result.isSuccess())
+              return make_success(n, result.value().second);
+            else if (result.isFatal())
+              return std::move(result).asError();
+          }
+        return make_success(n, detail::drop(input, n));
+      });
+}
+
+/**
+ * Applies one or more ocurrences of p, separated and optionally ended by sep.
+ * @return A list of the values returned by p.
+ */
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+sepEndBy1(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return Parser<std::list<T>, Input>(
+      p.getLabel() + " separated and optionally ended by " + sep.getLabel(),
+      [p, sep](Input input) ->
+      typename Parser<std::list<T>, Input>::result_type {
+        auto first = p.run(input);
+        if (first.isFailure()) return std::move(first).asError();
+
+        auto [x, remaining] = std::move(first).value();
+        std::list<T> xs{ std::move(x) };
+        while (1)
+          {
+            auto sepResult = sep.run(remaining);
+            if (sepResult.isFatal()) return std::move(sepResult).asError();
+            if (sepResult.isFailure()) break;
+            remaining = sepResult.value().second;
+
+            auto result = p.run(remaining);
+            if (result.isFatal()) return std::move(result).asError();
+            if (result.isFailure()) break;
+            auto [y, rest] = std::move(result).value();
+            xs.push_back(std::move(y));
+            remaining = rest;
+          }
+
+        return make_success(std::move(xs), remaining);
+      });
+}
+
+/**
+ * Applies zero or more ocurrences of p, separated and optionally ended by sep.
+ * @return A list of the values returned by p.
+ */
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+sepEndBy(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return sepEndBy1(p, sep) | pure<Input>(std::list<T>{});
+}
+
+/**
+ * Applies one or more ocurrences of p, each one followed by sep.
+ * @return A list of the values returned by p.
+ */
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+endBy1(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return many1(p < sep).withLabel(p.getLabel() + " ended by "
+                                  + sep.getLabel());
+}
+
+/**
+ * Applies zero or more ocurrences of p, each one followed by sep.
+ * @return A list of the values returned by p.
+ */
+template <typename T, typename Sep, typename Input>
+[[nodiscard]] constexpr Parser<std::list<T>, Input>
+endBy(const Parser<T, Input>& p, const Parser<Sep, Input>& sep) noexcept
+{
+  return many(p < sep).withLabel(p.getLabel() + " ended by "
+                                 + sep.getLabel());
+}
+
+/**
+ * Parses open, followed by p and then close.
+ * @return The value returned by p.
+ */
+template <typename Open, typename T, typename Close, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+between(const Parser<Open, Input>& open,
+        const Parser<Close, Input>& close,
+        const Parser<T, Input>& p) noexcept
+{
+  return (open > p < close)
+      .withLabel(p.getLabel() + " between " + open.getLabel() + " and "
+                 + close.getLabel());
+}
+
+/**
+ * Applies one or more ocurrences of p, separated by op, and folds the values
+ * returned by p from the left using the binary functions returned by op.
+ *
+ * This is the usual way to parse left associative binary operators.
+ */
+template <typename T, typename F, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+chainl1(const Parser<T, Input>& p, const Parser<F, Input>& op) noexcept
+{
+  return Parser<T, Input>(
+      p.getLabel() + " chained by " + op.getLabel(),
+      [p, op](Input input) -> typename Parser<T, Input>::result_type {
+        auto first = p.run(input);
+        if (first.isFailure()) return std::move(first).asError();
+
+        auto [acc, remaining] = std::move(first).value();
+        while (1)
+          {
+            auto opResult = op.run(remaining);
+            if (opResult.isFatal()) return std::move(opResult).asError();
+            if (opResult.isFailure()) break;
+            auto [f, afterOp] = std::move(opResult).value();
+
+            auto result = p.run(afterOp);
+            if (result.isFatal()) return std::move(result).asError();
+            if (result.isFailure()) break;
+            auto [y, rest] = std::move(result).value();
+            acc = f(std::move(acc), std::move(y));
+            remaining = rest;
+          }
+
+        return make_success(std::move(acc), remaining);
+      });
+}
+
+/**
+ * Applies one or more ocurrences of p, separated by op, and folds the values
+ * returned by p from the right using the binary functions returned by op.
+ *
+ * This is the usual way to parse right associative binary operators.
+ */
+template <typename T, typename F, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+chainr1(const Parser<T, Input>& p, const Parser<F, Input>& op) noexcept
+{
+  using result_type = typename Parser<T, Input>::result_type;
+
+  struct Chain
+  {
+    result_type
+    operator()(Input input) const
+    {
+      auto first = p.run(input);
+      if (first.isFailure()) return std::move(first).asError();
+
+      auto [x, remaining] = std::move(first).value();
+      auto opResult = op.run(remaining);
+      if (opResult.isFatal()) return std::move(opResult).asError();
+      if (opResult.isFailure()) return make_success(std::move(x), remaining);
+      auto [f, afterOp] = std::move(opResult).value();
+
+      // Each operand nests, see DepthLimit.
+      auto rest = detail::deeper(p.getLabel(),
+                                 [&] { return (*this)(afterOp); });
+      if (rest.isFatal()) return std::move(rest).asError();
+      if (rest.isFailure()) return make_success(std::move(x), remaining);
+      auto [y, afterRest] = std::move(rest).value();
+      return make_success<T>(f(std::move(x), std::move(y)), afterRest);
+    }
+
+    Parser<T, Input> p;
+    Parser<F, Input> op;
+  };
+
+  return Parser<T, Input>(p.getLabel() + " chained by " + op.getLabel(),
+                          Chain{ p, op });
+}
+
+namespace detail
+{
+
+/**
+ * Run p one level deeper, see deeper(label, f).
+ */
+template <typename T, typename Input>
+[[nodiscard]] typename Parser<T, Input>::result_type
+deeper(const Parser<T, Input>& p, Input input)
 {
-  return sepBy1(p, sep) | pure(std::list<T>{});
+  return deeper(p.getLabel(), [&] { return p.run(input); });
 }
 
+} // namespace detail
+
 /**
- * Return a parser that parses characters a long as the provided predicate holds
- * true.
+ * Limits how deeply parsers may nest on the calling thread while it is
+ * alive. This is a guard, which makes deeply nested or hostile input fail
+ * with a fatal ParserError instead of crashing: it does not make parsing
+ * stack safe, since every level still runs on the native stack.
+ *
+ * A level is a reference of a recursive() parser or of a PEG rule to itself
+ * or to a rule it is part of, an operand of chainr1(), a nested operand of
+ * expression(), or the parser returned by the function given to bind. Any
+ * other recursion, e.g. a function that runs a parser it captured by
+ * reference, is not counted and should go through recursive() instead.
+ *
+ * Nesting also stops when the stack of the thread, where it is known, runs
+ * low, keeping a quarter of it and at most 64 KiB for the parsers that run
+ * between two levels, so that small stacks, e.g. of worker threads, fail
+ * rather than overflow. The parsers of a level that need more than that
+ * can still overflow it.
+ *
+ * The limit is 1024 levels by default, and limits nest. recognize()
+ * reports reaching it as an ordinary mismatch.
  */
-template <typename Pred>
+class DepthLimit
+{
+public:
+  explicit DepthLimit(std::size_t levels) noexcept
+      : m_previous{ std::exchange(detail::depth().limit, levels) }
+  {
+  }
+
+  DepthLimit(const DepthLimit&) = delete;
+  DepthLimit& operator=(const DepthLimit&) = delete;
+
+  ~DepthLimit()
+  {
+    detail::depth().limit = m_previous;
+  }
+
+private:
+  std::size_t m_previous;
+};
+
+/**
+ * Build a parser that refers to itself, e.g. a parenthesized expression. f
+ * receives a parser that runs the one being built and returns its definition.
+ * Each time it does counts as a level, see DepthLimit.
+ *
+ * The reference handed to f does not own the definition, so it only stays
+ * valid for as long as the returned parser, or a copy of it, is alive.
+ */
+template <typename T, typename Input = std::string_view, typename F>
+[[nodiscard]] Parser<T, Input>
+recursive(F f)
+{
+  auto definition = std::make_shared<std::optional<Parser<T, Input> > >();
+  auto self = Parser<T, Input>([rule = definition.get()](Input input) {
+    return detail::deeper(**rule, input);
+  });
+  *definition = f(static_cast<const Parser<T, Input>&>(self));
+  return Parser<T, Input>((*definition)->getLabel(),
+                          [definition](Input input) {
+                            return (*definition)->run(input);
+                          });
+}
+
+/**
+ * Return a parser that parses elements for as long as the provided predicate
+ * holds true, and stops before the first one for which it does not.
+ */
+template <typename Input = std::string_view, typename Pred>
 [[nodiscard]] constexpr auto
 takeWhile(Pred predicate) noexcept
 {
-  return Parser<std::vector<char> >(
+  using element_type = input_element_t<Input>;
+  return Parser<std::vector<element_type>, Input>(
       "takeWhile",
-      [predicate](
-          std::string_view input) -> Parser<std::vector<char> >::result_type {
-        std::string::size_type i = 0;
-        std::vector<char> result{};
+      [predicate](Input input) ->
+      typename Parser<std::vector<element_type>, Input>::result_type {
+        std::size_t i = 0;
+        std::vector<element_type> result{};
 
-        for (; predicate(input[i]) && i < input.length(); i++)
+        for (; i < input.size() && predicate(input[i]); i++)
           result.push_back(input[i]);
 
-        return make_success(result, input.substr(i + 1));
+        return make_success(std::move(result), detail::drop(input, i));
       });
 }
 
@@ -458,26 +1728,34 @@ takeWhile(Pred predicate) noexcept
  * subject to change.
  *
  */
-template <typename Pred>
+template <typename Input = std::string_view, typename Pred>
 [[nodiscard]] constexpr auto
 skipWhile(Pred predicate) noexcept
 {
-  return takeWhile(predicate) >> pure(std::nullopt);
+  return takeWhile<Input>(predicate) >> pure<Input>(std::nullopt);
 }
 
 /**
  * Run the second parser, ignoring the result of the first one
  * and returning the result of the second one.
  */
-template <typename T, typename R>
-[[nodiscard]] constexpr Parser<R>
-operator>>(const Parser<T>& p1, const Parser<R>& p2)
+template <typename T, typename R, typename Input>
+[[nodiscard]] constexpr Parser<R, Input>
+operator>>(const Parser<T, Input>& p1, const Parser<R, Input>& p2)
 {
-  return (p1 >>=
-          [p2]([[maybe_unused]] T) {
-            return p2;
-          })
-      .withLabel(p1.getLabel() + " and then " + p2.getLabel());
+  auto label = p1.getLabel() + " and then " + p2.getLabel();
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    node = detail::composite<R>(ir::Kind::Sequence, label,
+                                { detail::nodeOf(p1), detail::nodeOf(p2) }, 1);
+  return Parser<R, Input>(
+      label,
+      [p1, p2](Input input) -> typename Parser<R, Input>::result_type {
+        auto result = p1.run(input);
+        if (result.isFailure()) return std::move(result).asError();
+        return p2.run(result.value().second);
+      },
+      std::move(node));
 }
 
 /**
@@ -485,36 +1763,82 @@ operator>>(const Parser<T>& p1, const Parser<R>& p2)
  * result of the second one and returning that of the first
  * one.
  */
-template <typename T, typename R>
-[[nodiscard]] constexpr Parser<T>
-operator<(const Parser<T>& p1, const Parser<R>& p2)
+template <typename T, typename R, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+operator<(const Parser<T, Input>& p1, const Parser<R, Input>& p2)
 {
-  return p1 >>= [p2](T value) -> Parser<T> {
-    return p2 & [value]([[maybe_unused]] R) {
-      return value;
-    };
-  };
+  auto label = p1.getLabel() + " followed by " + p2.getLabel();
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    node = detail::composite<T>(ir::Kind::Sequence, label,
+                                { detail::nodeOf(p1), detail::nodeOf(p2) }, 0);
+  return Parser<T, Input>(
+      label,
+      [p1, p2](Input input) -> typename Parser<T, Input>::result_type {
+        auto result = p1.run(input);
+        if (result.isFailure()) return std::move(result).asError();
+        auto [value, remaining] = std::move(result).value();
+
+        auto next = p2.run(remaining);
+        if (next.isFailure()) return std::move(next).asError();
+        return make_success(std::move(value), next.value().second);
+      },
+      std::move(node));
 }
 
-template <typename T, typename R>
-[[nodiscard]] constexpr Parser<R>
-operator>(const Parser<T>& p1, const Parser<R>& p2)
+template <typename T, typename R, typename Input>
+[[nodiscard]] constexpr Parser<R, Input>
+operator>(const Parser<T, Input>& p1, const Parser<R, Input>& p2)
 {
   return p1 >> p2;
 }
 
 /**
- * Run the second parser if the first one fails.
+ * Run the second parser if the first one fails, unless it failed with a
+ * fatal error.
  */
-template <typename T>
-[[nodiscard]] constexpr Parser<T>
-operator|(const Parser<T>& p1, const Parser<T>& p2)
+template <typename T, typename Input>
+[[nodiscard]] constexpr Parser<T, Input>
+operator|(const Parser<T, Input>& p1, const Parser<T, Input>& p2)
 {
   auto label = p1.getLabel() + " or " + p2.getLabel();
-  return Parser<T>(label, [p1, p2](std::string_view input) {
-    auto result = p1.run(input);
-    return result.isSuccess() ? result : p2.run(input);
-  });
+  ir::NodePtr node{};
+  if constexpr (detail::has_ir<Input>)
+    node = detail::composite<T>(ir::Kind::Choice, label,
+                                { detail::nodeOf(p1), detail::nodeOf(p2) });
+  return Parser<T, Input>(
+      label,
+      [p1, p2](Input input) {
+        auto result = p1.run(input);
+        if (result.isSuccess() || result.isFatal()) return result;
+        return p2.run(input);
+      },
+      std::move(node));
+}
+
+/**
+ * Rewrite p into an equivalent parser that runs faster, e.g. by fusing
+ * characters into literals, scanning repetitions of characters in bulk and
+ * left-factoring alternatives. See ir::Optimizer for the rewrites and what
+ * they assume about predicates and mapped functions.
+ *
+ * Parsers whose structure is unknown, such as those built by bind or
+ * recursive, are kept as they are, but the parsers they are combined with
+ * are still optimized. Only parsers over a std::string_view are rewritten.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Parser<T, Input>
+optimize(const Parser<T, Input>& p)
+{
+  if constexpr (detail::has_ir<Input>)
+    {
+      if (!p.node()) return p;
+      ir::Compiler compiler{};
+      auto optimized = detail::lowered<T>(compiler, ir::optimize(p.node()));
+      return optimized.withLabel(p.getLabel());
+    }
+  else
+    return p;
 }
 
 }
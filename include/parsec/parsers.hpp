@@ -1,12 +1,45 @@
 #pragma once
 
-#include <cctype>
+#include <array>
+#include <cstdint>
 
 #include "parsec.hpp"
 
 namespace parsec
 {
 
+namespace detail
+{
+
+enum AsciiClass : std::uint8_t
+{
+  AsciiDigit = 1,
+  AsciiLetter = 2,
+  AsciiSpace = 4,
+};
+
+/**
+ * The classes of the ASCII characters, as per isdigit, isalpha and isspace
+ * in the "C" locale. Unlike those, looking a character up depends on no
+ * locale and can be inlined.
+ */
+inline constexpr auto asciiClasses = [] {
+  std::array<std::uint8_t, 256> table{};
+  for (int c = '0'; c <= '9'; c++) table[c] |= AsciiDigit;
+  for (int c = 'a'; c <= 'z'; c++) table[c] |= AsciiLetter;
+  for (int c = 'A'; c <= 'Z'; c++) table[c] |= AsciiLetter;
+  for (int c : { ' ', '\t', '\n', '\v', '\f', '\r' }) table[c] |= AsciiSpace;
+  return table;
+}();
+
+[[nodiscard]] constexpr bool
+isAscii(char c, AsciiClass ascii) noexcept
+{
+  return asciiClasses[static_cast<unsigned char>(c)] & ascii;
+}
+
+} // namespace detail
+
 /**
  * Parse any one character.
  */
@@ -32,7 +65,8 @@ notChar(char charToNotMatch)
 static inline Parser<char>
 digit()
 {
-  return satisfy(isdigit, "digit");
+  return satisfy([](char c) { return detail::isAscii(c, detail::AsciiDigit); },
+                 "digit");
 }
 
 /**
@@ -58,21 +92,24 @@ decimal()
 }
 
 /**
- * Parse an ascii letter, as per isalpha.
+ * Parse an ascii letter, as per isalpha in the "C" locale.
  */
 static inline auto
 letter()
 {
-  return satisfy(isalpha, "letter");
+  return satisfy(
+      [](char c) { return detail::isAscii(c, detail::AsciiLetter); },
+      "letter");
 }
 
 /**
- * Parse a space character, as per isspace.
+ * Parse a space character, as per isspace in the "C" locale.
  */
 static inline auto
 space()
 {
-  return satisfy(isspace, "space");
+  return satisfy([](char c) { return detail::isAscii(c, detail::AsciiSpace); },
+                 "space");
 }
 
 }
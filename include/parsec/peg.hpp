@@ -0,0 +1,995 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parsec.hpp"
+#include "parsers.hpp"
+
+namespace parsec
+{
+
+namespace peg
+{
+
+/**
+ * A span of the input matched by a named expression of a grammar.
+ */
+struct Capture
+{
+  std::string_view name;
+  std::string_view text;
+
+  [[nodiscard]] bool
+  operator==(const Capture&) const = default;
+};
+
+using Captures = std::vector<Capture>;
+
+namespace detail
+{
+
+struct Expr
+{
+  enum class Kind : std::uint8_t
+  {
+    Literal,
+    Class,
+    Any,
+    Rule,
+    Sequence,
+    Choice,
+    Star,
+    Plus,
+    Optional,
+    And,
+    Not,
+    Capture,
+  };
+
+  Kind kind = Kind::Sequence;
+  std::string text{};     // Literal: the text; Rule, Capture: the name
+  std::bitset<256> set{}; // Class
+  std::size_t rule = 0;   // Rule: the index of the rule
+  std::vector<Expr> children{};
+};
+
+struct Rule
+{
+  std::string name;
+  Expr expr;
+  bool captures = false; // Whether matching the rule captures anything
+};
+
+using Rules = std::vector<Rule>;
+
+/**
+ * Recursive descent over the text of a grammar.
+ */
+class Loader
+{
+public:
+  explicit Loader(std::string_view text) noexcept : m_text{ text } {}
+
+  Rules
+  load()
+  {
+    Rules rules{};
+    spacing();
+    while (m_pos < m_text.size())
+      {
+        auto name = identifier();
+        if (!token("<-")) fail("Expected '<-'");
+        rules.push_back({ std::move(name), expression() });
+      }
+    if (rules.empty()) fail("Empty grammar");
+    return rules;
+  }
+
+private:
+  [[noreturn]] void
+  fail(const std::string& message) const
+  {
+    throw ParserError::create("peg", message + " at offset "
+                                         + std::to_string(m_pos));
+  }
+
+  [[nodiscard]] bool
+  at(char c) const noexcept
+  {
+    return m_pos < m_text.size() && m_text[m_pos] == c;
+  }
+
+  [[nodiscard]] static bool
+  isIdentifier(char c, bool first) noexcept
+  {
+    return parsec::detail::isAscii(c, parsec::detail::AsciiLetter) || c == '_'
+        || (!first && parsec::detail::isAscii(c, parsec::detail::AsciiDigit));
+  }
+
+  // Skip spaces and comments, which run from '#' to the end of the line.
+  void
+  spacing() noexcept
+  {
+    while (m_pos < m_text.size())
+      if (at('#'))
+        while (m_pos < m_text.size() && m_text[m_pos] != '\n') m_pos++;
+      else if (parsec::detail::isAscii(m_text[m_pos],
+                                       parsec::detail::AsciiSpace))
+        m_pos++;
+      else
+        break;
+  }
+
+  bool
+  token(std::string_view text) noexcept
+  {
+    if (!m_text.substr(m_pos).starts_with(text)) return false;
+    m_pos += text.size();
+    spacing();
+    return true;
+  }
+
+  std::string
+  identifier()
+  {
+    auto begin = m_pos;
+    while (m_pos < m_text.size() && isIdentifier(m_text[m_pos], m_pos == begin))
+      m_pos++;
+    if (m_pos == begin) fail("Expected a rule name");
+    auto name = std::string(m_text.substr(begin, m_pos - begin));
+    spacing();
+    return name;
+  }
+
+  // Whether the next identifier starts a definition, which ends the
+  // sequence before it.
+  [[nodiscard]] bool
+  atDefinition() const noexcept
+  {
+    auto pos = m_pos;
+    while (pos < m_text.size() && isIdentifier(m_text[pos], pos == m_pos))
+      pos++;
+    if (pos == m_pos) return false;
+    while (pos < m_text.size()
+           && parsec::detail::isAscii(m_text[pos], parsec::detail::AsciiSpace))
+      pos++;
+    return m_text.substr(pos).starts_with("<-");
+  }
+
+  Expr
+  expression()
+  {
+    Expr choice{ Expr::Kind::Choice };
+    choice.children.push_back(sequence());
+    while (token("/")) choice.children.push_back(sequence());
+    if (choice.children.size() == 1) return std::move(choice.children[0]);
+    return choice;
+  }
+
+  Expr
+  sequence()
+  {
+    Expr sequence{ Expr::Kind::Sequence };
+    while (m_pos < m_text.size() && !at('/') && !at(')') && !atDefinition())
+      sequence.children.push_back(prefix());
+    if (sequence.children.size() == 1) return std::move(sequence.children[0]);
+    return sequence;
+  }
+
+  Expr
+  prefix()
+  {
+    for (auto [c, kind] : { std::pair{ "&", Expr::Kind::And },
+                            std::pair{ "!", Expr::Kind::Not } })
+      if (token(c))
+        {
+          Expr predicate{ kind };
+          predicate.children.push_back(labeled());
+          return predicate;
+        }
+    return labeled();
+  }
+
+  // A capture, written name:expression.
+  Expr
+  labeled()
+  {
+    auto pos = m_pos;
+    if (pos < m_text.size() && isIdentifier(m_text[m_pos], true))
+      {
+        auto name = identifier();
+        if (token(":"))
+          {
+            Expr capture{ Expr::Kind::Capture, std::move(name) };
+            capture.children.push_back(suffix());
+            return capture;
+          }
+        m_pos = pos;
+      }
+    return suffix();
+  }
+
+  Expr
+  suffix()
+  {
+    auto expr = primary();
+    for (auto [c, kind] : { std::pair{ "*", Expr::Kind::Star },
+                            std::pair{ "+", Expr::Kind::Plus },
+                            std::pair{ "?", Expr::Kind::Optional } })
+      if (token(c))
+        {
+          Expr repetition{ kind };
+          repetition.children.push_back(std::move(expr));
+          return repetition;
+        }
+    return expr;
+  }
+
+  Expr
+  primary()
+  {
+    if (m_pos >= m_text.size()) fail("Unexpected end of grammar");
+    if (token("("))
+      {
+        auto expr = expression();
+        if (!token(")")) fail("Expected ')'");
+        return expr;
+      }
+    if (token(".")) return Expr{ Expr::Kind::Any };
+    if (at('\'') || at('"')) return literal();
+    if (at('[')) return charClass();
+    if (isIdentifier(m_text[m_pos], true))
+      return Expr{ Expr::Kind::Rule, identifier() };
+    fail(std::string("Unexpected '") + m_text[m_pos] + "'");
+  }
+
+  Expr
+  literal()
+  {
+    auto quote = m_text[m_pos++];
+    Expr literal{ Expr::Kind::Literal };
+    while (m_pos < m_text.size() && !at(quote)) literal.text += character();
+    if (!at(quote)) fail("Unterminated literal");
+    m_pos++;
+    spacing();
+    return literal;
+  }
+
+  Expr
+  charClass()
+  {
+    m_pos++;
+    Expr charClass{ Expr::Kind::Class };
+    bool negated = at('^');
+    if (negated) m_pos++;
+    while (m_pos < m_text.size() && !at(']'))
+      {
+        auto lo = static_cast<unsigned char>(character());
+        auto hi = lo;
+        if (at('-') && m_pos + 1 < m_text.size() && m_text[m_pos + 1] != ']')
+          {
+            m_pos++;
+            hi = static_cast<unsigned char>(character());
+            if (hi < lo) fail("Invalid range");
+          }
+        for (unsigned c = lo; c <= hi; c++) charClass.set.set(c);
+      }
+    if (!at(']')) fail("Unterminated character class");
+    m_pos++;
+    spacing();
+    if (negated) charClass.set.flip();
+    return charClass;
+  }
+
+  // A character of a literal or a class, which may be escaped.
+  char
+  character()
+  {
+    auto c = m_text[m_pos++];
+    if (c != '\\') return c;
+    if (m_pos >= m_text.size()) fail("Unterminated escape");
+    c = m_text[m_pos++];
+    switch (c)
+      {
+      case 'n': return '\n';
+      case 't': return '\t';
+      case 'r': return '\r';
+      case 'x':
+        {
+          int value = 0;
+          for (int i = 0; i < 2; i++)
+            {
+              auto h = m_pos < m_text.size() ? m_text[m_pos++] : '\0';
+              int digit = h >= '0' && h <= '9'   ? h - '0'
+                        : h >= 'a' && h <= 'f' ? h - 'a' + 10
+                        : h >= 'A' && h <= 'F' ? h - 'A' + 10
+                                               : -1;
+              if (digit < 0) fail("Invalid \\x escape");
+              value = value * 16 + digit;
+            }
+          return static_cast<char>(value);
+        }
+      default:
+        return c;
+      }
+  }
+
+  std::string_view m_text;
+  std::size_t m_pos = 0;
+};
+
+/**
+ * Resolves the rule names of a grammar and rejects what would not terminate:
+ * left recursion, and repetitions of expressions that can match nothing.
+ */
+class Analyzer
+{
+public:
+  explicit Analyzer(Rules& rules) noexcept : m_rules{ rules } {}
+
+  void
+  analyze()
+  {
+    for (std::size_t i = 0; i < m_rules.size(); i++)
+      for (std::size_t j = 0; j < i; j++)
+        if (m_rules[i].name == m_rules[j].name)
+          fail("Rule '" + m_rules[i].name + "' is defined twice");
+    for (auto& rule : m_rules) resolve(rule.expr);
+
+    // Both properties may depend on rules defined later, so they are
+    // computed up to a fixed point.
+    m_nullable.assign(m_rules.size(), false);
+    for (bool changed = true; changed;)
+      {
+        changed = false;
+        for (std::size_t i = 0; i < m_rules.size(); i++)
+          {
+            auto nullable = this->nullable(m_rules[i].expr);
+            auto captures = this->captures(m_rules[i].expr);
+            changed |= nullable != m_nullable[i]
+                    || captures != m_rules[i].captures;
+            m_nullable[i] = nullable;
+            m_rules[i].captures = captures;
+          }
+      }
+
+    for (std::size_t i = 0; i < m_rules.size(); i++)
+      {
+        std::vector<bool> visiting(m_rules.size(), false);
+        visiting[i] = true;
+        leftCalls(m_rules[i].expr, i, visiting);
+        repetitions(m_rules[i].expr, m_rules[i].name);
+      }
+  }
+
+private:
+  [[noreturn]] static void
+  fail(const std::string& message)
+  {
+    throw ParserError::create("peg", message);
+  }
+
+  void
+  resolve(Expr& expr)
+  {
+    if (expr.kind == Expr::Kind::Rule)
+      {
+        for (std::size_t i = 0; i < m_rules.size(); i++)
+          if (m_rules[i].name == expr.text)
+            {
+              expr.rule = i;
+              return;
+            }
+        fail("Undefined rule '" + expr.text + "'");
+      }
+    for (auto& child : expr.children) resolve(child);
+  }
+
+  bool
+  nullable(const Expr& expr) const
+  {
+    switch (expr.kind)
+      {
+      case Expr::Kind::Literal:
+        return expr.text.empty();
+      case Expr::Kind::Class:
+      case Expr::Kind::Any:
+        return false;
+      case Expr::Kind::Rule:
+        return m_nullable[expr.rule];
+      case Expr::Kind::Sequence:
+        for (const auto& child : expr.children)
+          if (!nullable(child)) return false;
+        return true;
+      case Expr::Kind::Choice:
+        for (const auto& child : expr.children)
+          if (nullable(child)) return true;
+        return false;
+      case Expr::Kind::Plus:
+      case Expr::Kind::Capture:
+        return nullable(expr.children[0]);
+      default:
+        return true;
+      }
+  }
+
+  bool
+  captures(const Expr& expr) const
+  {
+    switch (expr.kind)
+      {
+      case Expr::Kind::Capture:
+        return true;
+      case Expr::Kind::Rule:
+        return m_rules[expr.rule].captures;
+      case Expr::Kind::And:
+      case Expr::Kind::Not:
+        return false;
+      default:
+        for (const auto& child : expr.children)
+          if (captures(child)) return true;
+        return false;
+      }
+  }
+
+  // Follow the rules that expr may call before consuming any input.
+  void
+  leftCalls(const Expr& expr, std::size_t rule, std::vector<bool>& visiting)
+  {
+    switch (expr.kind)
+      {
+      case Expr::Kind::Rule:
+        if (expr.rule == rule)
+          fail("Rule '" + m_rules[rule].name + "' is left recursive");
+        if (visiting[expr.rule]) return;
+        visiting[expr.rule] = true;
+        leftCalls(m_rules[expr.rule].expr, rule, visiting);
+        return;
+      case Expr::Kind::Sequence:
+        for (const auto& child : expr.children)
+          {
+            leftCalls(child, rule, visiting);
+            if (!nullable(child)) return;
+          }
+        return;
+      default:
+        for (const auto& child : expr.children)
+          leftCalls(child, rule, visiting);
+      }
+  }
+
+  void
+  repetitions(const Expr& expr, const std::string& rule)
+  {
+    if ((expr.kind == Expr::Kind::Star || expr.kind == Expr::Kind::Plus)
+        && nullable(expr.children[0]))
+      fail("Rule '" + rule + "' repeats an expression that can match nothing");
+    for (const auto& child : expr.children) repetitions(child, rule);
+  }
+
+  Rules& m_rules;
+  std::vector<bool> m_nullable{};
+};
+
+/**
+ * Builds the parsers of the rules of a grammar out of combinators, so that
+ * they are optimized like parsers written in C++. Rules are inlined into the
+ * rules that use them, unless they are recursive.
+ *
+ * Expressions that capture nothing compile to recognizers, which only
+ * produce the span they matched, and the others to parsers of captures.
+ */
+class Compiler
+{
+public:
+  struct Compiled
+  {
+    std::optional<Parser<std::string_view> > recognizer{};
+    std::optional<Parser<Captures> > captures{};
+  };
+
+  Compiler(const Rules& rules, std::vector<Compiled>& compiled) noexcept
+      : m_rules{ rules }, m_compiled{ compiled },
+        m_state(rules.size(), State::Pending)
+  {
+  }
+
+  void
+  compile(std::size_t rule)
+  {
+    if (m_state[rule] != State::Pending) return;
+    m_state[rule] = State::Compiling;
+    const auto& definition = m_rules[rule];
+    m_compiled[rule].recognizer
+        = optimize(recognizer(definition.expr)).withLabel(definition.name);
+    if (definition.captures)
+      m_compiled[rule].captures
+          = optimize(captures(definition.expr)).withLabel(definition.name);
+    m_state[rule] = State::Compiled;
+  }
+
+private:
+  enum class State
+  {
+    Pending,
+    Compiling,
+    Compiled,
+  };
+
+  static Parser<std::string_view>
+  empty()
+  {
+    return consumed(stringP(""));
+  }
+
+  Parser<std::string_view>
+  recognizer(const Expr& expr)
+  {
+    using Kind = Expr::Kind;
+    switch (expr.kind)
+      {
+      case Kind::Literal:
+        return consumed(stringP(expr.text));
+      case Kind::Class:
+        return consumed(satisfy(
+            [set = expr.set](char c) {
+              return set[static_cast<unsigned char>(c)];
+            },
+            ir::detail::showSet(expr.set)));
+      case Kind::Any:
+        return consumed(anyChar());
+      case Kind::Rule:
+        {
+          compile(expr.rule);
+          if (m_state[expr.rule] == State::Compiled)
+            return *m_compiled[expr.rule].recognizer;
+          // A recursive reference, resolved once the rule is compiled.
+          auto* compiled = &m_compiled[expr.rule];
+          return Parser<std::string_view>(
+              expr.text,
+              [compiled](std::string_view input) {
+                return parsec::detail::deeper(*compiled->recognizer, input);
+              });
+        }
+      case Kind::Sequence:
+        {
+          auto sequence = empty();
+          for (const auto& child : expr.children)
+            sequence = sequence >> recognizer(child);
+          return consumed(sequence);
+        }
+      case Kind::Choice:
+        {
+          auto choice = recognizer(expr.children[0]);
+          for (std::size_t i = 1; i < expr.children.size(); i++)
+            choice = choice | recognizer(expr.children[i]);
+          return choice;
+        }
+      case Kind::Star:
+        return consumed(many(recognizer(expr.children[0])));
+      case Kind::Plus:
+        return consumed(many1(recognizer(expr.children[0])));
+      case Kind::Optional:
+        return recognizer(expr.children[0]) | empty();
+      case Kind::And:
+      case Kind::Not:
+        {
+          auto p = recognizer(expr.children[0]);
+          bool expected = expr.kind == Kind::And;
+          auto label = (expected ? "&" : "!") + p.getLabel();
+          return Parser<std::string_view>(
+              label,
+              [p, expected, label](
+                  std::string_view input
+              ) -> Parser<std::string_view>::result_type {
+                auto result = p.run(input);
+                if (result.isFatal()) return std::move(result).asError();
+                if (result.isSuccess() != expected)
+                  return ParserError::create(label, "Failed to parse");
+                return make_success(input.substr(0, 0), input);
+              });
+        }
+      case Kind::Capture:
+        return recognizer(expr.children[0]);
+      }
+    return empty();
+  }
+
+  Parser<Captures>
+  captures(const Expr& expr)
+  {
+    using Kind = Expr::Kind;
+    using result_type = Parser<Captures>::result_type;
+    if (!hasCaptures(expr))
+      return recognizer(expr) & [](std::string_view) { return Captures{}; };
+
+    switch (expr.kind)
+      {
+      case Kind::Rule:
+        {
+          compile(expr.rule);
+          if (m_state[expr.rule] == State::Compiled)
+            return *m_compiled[expr.rule].captures;
+          auto* compiled = &m_compiled[expr.rule];
+          return Parser<Captures>(
+              expr.text, [compiled](std::string_view input) {
+                return parsec::detail::deeper(*compiled->captures, input);
+              });
+        }
+      case Kind::Sequence:
+        {
+          std::vector<Parser<Captures> > children{};
+          for (const auto& child : expr.children)
+            children.push_back(captures(child));
+          return Parser<Captures>(
+              "sequence",
+              [children](std::string_view input) -> result_type {
+                Captures result{};
+                for (const auto& child : children)
+                  {
+                    auto next = child.run(input);
+                    if (next.isFailure()) return next;
+                    auto [captures, rest] = std::move(next).value();
+                    result.insert(result.end(), captures.begin(),
+                                  captures.end());
+                    input = rest;
+                  }
+                return make_success(std::move(result), input);
+              });
+        }
+      case Kind::Choice:
+        {
+          auto choice = captures(expr.children[0]);
+          for (std::size_t i = 1; i < expr.children.size(); i++)
+            choice = choice | captures(expr.children[i]);
+          return choice;
+        }
+      case Kind::Star:
+      case Kind::Plus:
+        {
+          auto p = captures(expr.children[0]);
+          std::size_t min = expr.kind == Kind::Plus ? 1 : 0;
+          return Parser<Captures>(
+              p.getLabel(),
+              [p, min](std::string_view input) -> result_type {
+                Captures result{};
+                for (std::size_t n = 0;; n++)
+                  {
+                    auto next = p.run(input);
+                    if (next.isFailure())
+                      {
+                        if (n < min || next.isFatal()) return next;
+                        return make_success(std::move(result), input);
+                      }
+                    auto [captures, rest] = std::move(next).value();
+                    result.insert(result.end(), captures.begin(),
+                                  captures.end());
+                    input = rest;
+                  }
+              });
+        }
+      case Kind::Optional:
+        return captures(expr.children[0])
+             | (empty() & [](std::string_view) { return Captures{}; });
+      case Kind::Capture:
+        {
+          auto p = captures(expr.children[0]);
+          std::string_view name = expr.text;
+          return Parser<Captures>(
+              expr.text,
+              [p, name](std::string_view input) -> result_type {
+                auto result = p.run(input);
+                if (result.isFailure()) return result;
+                auto [captures, rest] = std::move(result).value();
+                auto text = input.substr(0, input.size() - rest.size());
+                captures.insert(captures.begin(), { name, text });
+                return make_success(std::move(captures), rest);
+              });
+        }
+      default:
+        return recognizer(expr) & [](std::string_view) { return Captures{}; };
+      }
+  }
+
+  bool
+  hasCaptures(const Expr& expr) const
+  {
+    switch (expr.kind)
+      {
+      case Expr::Kind::Capture:
+        return true;
+      case Expr::Kind::Rule:
+        return m_rules[expr.rule].captures;
+      case Expr::Kind::And:
+      case Expr::Kind::Not:
+        return false;
+      default:
+        for (const auto& child : expr.children)
+          if (hasCaptures(child)) return true;
+        return false;
+      }
+  }
+
+  const Rules& m_rules;
+  std::vector<Compiled>& m_compiled;
+  std::vector<State> m_state;
+};
+
+} // namespace detail
+
+/**
+ * A parsing expression grammar loaded at runtime, e.g.
+ *
+ *     # A comment
+ *     pairs <- pair (',' pair)*
+ *     pair  <- key:[a-z]+ '=' value:number
+ *     number <- '-'? [0-9]+
+ *
+ * Expressions are literals ('...' or "..."), character classes ([a-z_],
+ * [^,]), '.', references to rules, groups, sequences, ordered choices (/),
+ * the repetitions *, + and ?, the predicates & and !, and captures, written
+ * name:expression. The escapes \n \t \r \xHH and \ followed by any other
+ * character can be used in literals and classes.
+ *
+ * Loading a grammar resolves and checks its rules. Its serialized form can
+ * be stored, e.g. in a cache keyed by the text of the grammar, and loaded
+ * back without parsing the grammar again. The rules are checked again when
+ * they are loaded back, since the bytes may have been corrupted.
+ */
+class Grammar
+{
+public:
+  /**
+   * Load the text of a grammar.
+   * @throws ParserError if the grammar is malformed, refers to undefined
+   * rules, or has rules that would not terminate.
+   */
+  [[nodiscard]] static Grammar
+  load(std::string_view text)
+  {
+    auto rules = detail::Loader{ text }.load();
+    detail::Analyzer{ rules }.analyze();
+    return Grammar{ std::move(rules) };
+  }
+
+  /**
+   * Load a grammar serialized by serialize().
+   * @throws ParserError if bytes is not a serialized grammar, or if its
+   * rules do not pass the checks of load().
+   */
+  [[nodiscard]] static Grammar
+  deserialize(std::string_view bytes)
+  {
+    Reader reader{ bytes };
+    if (!bytes.starts_with(magic)) reader.fail();
+    reader.pos = magic.size();
+    detail::Rules rules(reader.number());
+    if (rules.empty()) reader.fail();
+    for (auto& rule : rules)
+      {
+        rule.name = reader.string();
+        // Recomputed by the analyzer rather than trusted.
+        reader.byte();
+        rule.expr = reader.expr();
+      }
+    if (reader.pos != bytes.size()) reader.fail();
+    detail::Analyzer{ rules }.analyze();
+    return Grammar{ std::move(rules) };
+  }
+
+  [[nodiscard]] std::string
+  serialize() const
+  {
+    std::string bytes{ magic };
+    number(bytes, m_rules->size());
+    for (const auto& rule : *m_rules)
+      {
+        string(bytes, rule.name);
+        bytes += static_cast<char>(rule.captures);
+        expr(bytes, rule.expr);
+      }
+    return bytes;
+  }
+
+  /**
+   * The parser of the rule named start, or of the first rule. It returns
+   * the captures made while matching, in the order in which they start.
+   * Capture names and the grammar are kept alive by the parser.
+   * @throws ParserError if there is no such rule.
+   */
+  [[nodiscard]] Parser<Captures>
+  compile(std::string_view start = {}) const
+  {
+    std::size_t rule = 0;
+    if (!start.empty())
+      {
+        while (rule < m_rules->size() && (*m_rules)[rule].name != start)
+          rule++;
+        if (rule == m_rules->size())
+          throw ParserError::create("peg", "Undefined rule '"
+                                               + std::string(start) + "'");
+      }
+
+    // Recursive rules refer to each other through the table, which the
+    // returned parser keeps alive along with the names of the captures.
+    auto compiled
+        = std::make_shared<std::vector<detail::Compiler::Compiled> >(
+            m_rules->size());
+    detail::Compiler{ *m_rules, *compiled }.compile(rule);
+
+    // The parser has no IR node: parsers lowered from it would not keep the
+    // table alive.
+    const auto& entry = (*compiled)[rule];
+    auto p = entry.captures ? *entry.captures
+                            : *entry.recognizer & [](std::string_view) {
+                                return Captures{};
+                              };
+    return Parser<Captures>(
+        p.getLabel(),
+        [p, compiled, rules = m_rules](std::string_view input) {
+          return p.run(input);
+        });
+  }
+
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_rules->size();
+  }
+
+private:
+  static constexpr std::string_view magic = "PEG\x01";
+
+  explicit Grammar(detail::Rules rules)
+      : m_rules{ std::make_shared<const detail::Rules>(std::move(rules)) }
+  {
+  }
+
+  static void
+  number(std::string& bytes, std::size_t n)
+  {
+    for (; n >= 0x80; n >>= 7) bytes += static_cast<char>((n & 0x7f) | 0x80);
+    bytes += static_cast<char>(n);
+  }
+
+  static void
+  string(std::string& bytes, std::string_view s)
+  {
+    number(bytes, s.size());
+    bytes += s;
+  }
+
+  static void
+  expr(std::string& bytes, const detail::Expr& expr)
+  {
+    using Kind = detail::Expr::Kind;
+    bytes += static_cast<char>(expr.kind);
+    switch (expr.kind)
+      {
+      case Kind::Literal:
+      case Kind::Capture:
+        string(bytes, expr.text);
+        break;
+      case Kind::Class:
+        for (unsigned i = 0; i < 256; i += 8)
+          {
+            unsigned byte = 0;
+            for (unsigned j = 0; j < 8; j++) byte |= expr.set[i + j] << j;
+            bytes += static_cast<char>(byte);
+          }
+        break;
+      case Kind::Rule:
+        string(bytes, expr.text);
+        number(bytes, expr.rule);
+        break;
+      default:
+        break;
+      }
+    if (expr.kind == Kind::Sequence || expr.kind == Kind::Choice)
+      number(bytes, expr.children.size());
+    for (const auto& child : expr.children) Grammar::expr(bytes, child);
+  }
+
+  struct Reader
+  {
+    std::string_view bytes;
+    std::size_t pos = 0;
+
+    [[noreturn]] static void
+    fail()
+    {
+      throw ParserError::create("peg", "Malformed serialized grammar");
+    }
+
+    std::uint8_t
+    byte()
+    {
+      if (pos >= bytes.size()) fail();
+      return static_cast<std::uint8_t>(bytes[pos++]);
+    }
+
+    std::size_t
+    number()
+    {
+      std::size_t n = 0;
+      for (unsigned shift = 0;; shift += 7)
+        {
+          if (shift >= 64) fail();
+          auto b = byte();
+          n |= static_cast<std::size_t>(b & 0x7f) << shift;
+          if (!(b & 0x80)) return n;
+        }
+    }
+
+    std::string
+    string()
+    {
+      auto n = number();
+      if (n > bytes.size() - pos) fail();
+      auto s = std::string(bytes.substr(pos, n));
+      pos += n;
+      return s;
+    }
+
+    detail::Expr
+    expr()
+    {
+      using Kind = detail::Expr::Kind;
+      auto kind = byte();
+      if (kind > static_cast<std::uint8_t>(Kind::Capture)) fail();
+      detail::Expr result{ static_cast<Kind>(kind) };
+
+      std::size_t children = 1;
+      switch (result.kind)
+        {
+        case Kind::Literal:
+          result.text = string();
+          children = 0;
+          break;
+        case Kind::Capture:
+          result.text = string();
+          break;
+        case Kind::Class:
+          for (unsigned i = 0; i < 256; i += 8)
+            {
+              auto b = byte();
+              for (unsigned j = 0; j < 8; j++)
+                result.set[i + j] = (b >> j) & 1;
+            }
+          children = 0;
+          break;
+        case Kind::Any:
+          children = 0;
+          break;
+        case Kind::Rule:
+          result.text = string();
+          result.rule = number();
+          children = 0;
+          break;
+        case Kind::Sequence:
+        case Kind::Choice:
+          children = number();
+          if (children > bytes.size() - pos) fail();
+          break;
+        default:
+          break;
+        }
+      for (std::size_t i = 0; i < children; i++)
+        result.children.push_back(expr());
+      if (result.kind == Kind::Choice && result.children.empty()) fail();
+      return result;
+    }
+  };
+
+  std::shared_ptr<const detail::Rules> m_rules;
+};
+
+} // namespace peg
+
+} // namespace parsec
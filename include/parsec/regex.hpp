@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "automaton.hpp"
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * Parse the longest prefix of the input that pattern matches, e.g.
+ * regex("[0-9]{1,3}(\\.[0-9]{1,3}){3}") for an IPv4 address. The pattern is
+ * compiled once into a DFA (see detail::Automaton for its syntax), so a
+ * token is matched in a single pass without allocating or backtracking.
+ * @throws ParserError if pattern is malformed.
+ * @return The matched span of the input.
+ */
+static inline Parser<std::string_view>
+regex(const std::string& pattern)
+{
+  using result_type = Parser<std::string_view>::result_type;
+  auto automaton = std::make_shared<const detail::Automaton>(
+      std::vector<std::string>{ pattern });
+  auto run = [automaton, pattern](std::string_view input) -> result_type {
+    auto [length, rule] = automaton->longest(input);
+    if (rule < 0) return ParserError::create(pattern, "Failed to parse");
+    return make_success(input.substr(0, length), input.substr(length));
+  };
+
+  // An opaque node skipping with the DFA, so that a compiled parser runs it
+  // without going through the closure.
+  auto node = std::make_shared<ir::Node>();
+  node->label = pattern;
+  node->type = &typeid(std::string_view);
+  node->skip = [automaton](
+                   std::string_view input) -> std::optional<std::string_view> {
+    auto [length, rule] = automaton->longest(input);
+    if (rule < 0) return std::nullopt;
+    return input.substr(length);
+  };
+  node->lower = [parser = Parser<std::string_view>(pattern, run)](
+                    const ir::NodePtr&, ir::Compiler&) {
+    return std::make_shared<const Parser<std::string_view> >(parser);
+  };
+  return Parser<std::string_view>(pattern, run, std::move(node));
+}
+
+} // namespace parsec
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "parsec.hpp"
+#include "stream.hpp"
+
+namespace parsec
+{
+
+/**
+ * Reads a file descriptor, e.g. a pipe or a socket, ahead of the parser on
+ * a background thread, so that waiting for input overlaps with parsing.
+ *
+ * The thread reads into a small pool of buffers. The parser sees the input
+ * it has not consumed yet as a view into them, and a buffer goes back to the
+ * pool as soon as the parser is done with it. Bytes are only ever copied
+ * when a record straddles two reads: its beginning is moved in front of the
+ * next buffer, which keeps the window contiguous. A record longer than a
+ * chunk is gathered in a buffer that grows geometrically instead, so that
+ * it is copied a bounded number of times whatever its length.
+ *
+ * A source is meant to be used by a single thread, and does not close its
+ * file descriptor.
+ */
+class FdSource
+{
+public:
+  /**
+   * Start reading fd, chunk bytes at a time, at most depth chunks ahead.
+   * @throws std::system_error if the reader cannot be started.
+   */
+  explicit FdSource(int fd, std::size_t chunk = 1 << 16, std::size_t depth = 4)
+      : m_fd{ fd }, m_chunk{ chunk }
+  {
+    if (::pipe(m_wake) != 0)
+      throw std::system_error(errno, std::generic_category(), "pipe");
+    for (std::size_t i = 0; i < std::max<std::size_t>(depth, 2); i++)
+      m_free.push_back(std::make_unique<Buffer>(2 * chunk));
+    m_reader = std::thread{ [this] { readAhead(); } };
+  }
+
+  FdSource(const FdSource&) = delete;
+  FdSource& operator=(const FdSource&) = delete;
+
+  ~FdSource()
+  {
+    {
+      std::lock_guard lock{ m_mutex };
+      m_stopped = true;
+    }
+    m_space.notify_one();
+    [[maybe_unused]] auto written = ::write(m_wake[1], "", 1);
+    m_reader.join();
+    ::close(m_wake[0]);
+    ::close(m_wake[1]);
+  }
+
+  /**
+   * The input read so far that has not been consumed.
+   */
+  [[nodiscard]] std::string_view
+  window() const noexcept
+  {
+    return m_window;
+  }
+
+  /**
+   * Consume the first n bytes of the window.
+   */
+  void
+  consume(std::size_t n) noexcept
+  {
+    m_window.remove_prefix(n);
+    if (!m_window.empty()) return;
+    release(std::move(m_current));
+    m_carried = false;
+  }
+
+  /**
+   * Wait for the next read and append it to the window.
+   * @return false at the end of the input.
+   * @throws std::system_error if reading failed.
+   */
+  bool
+  fill()
+  {
+    if (m_done) return false;
+
+    std::unique_ptr<Buffer> next{};
+    int error = 0;
+    {
+      std::unique_lock lock{ m_mutex };
+      m_data.wait(lock, [this] { return !m_full.empty(); });
+      next = std::move(m_full.front());
+      m_full.pop_front();
+      error = m_error;
+    }
+    if (next->size == 0)
+      {
+        m_done = true;
+        if (error)
+          throw std::system_error(error, std::generic_category(), "read");
+        return false;
+      }
+
+    auto& bytes = next->bytes;
+    auto room = bytes.size() - m_chunk;
+    if (m_window.size() > room)
+      {
+        carry({ bytes.data() + room, next->size });
+        release(std::move(next));
+        release(std::move(m_current));
+        return true;
+      }
+
+    // Move the unconsumed bytes in front of the new ones.
+    auto begin = room - m_window.size();
+    if (!m_window.empty())
+      std::memcpy(bytes.data() + begin, m_window.data(), m_window.size());
+    m_window = { bytes.data() + begin, m_window.size() + next->size };
+    m_carried = false;
+
+    release(std::move(m_current));
+    m_current = std::move(next);
+    return true;
+  }
+
+private:
+  struct Buffer
+  {
+    explicit Buffer(std::size_t size) : bytes(size) {}
+
+    // Reads go to the last chunk bytes, the rest is room for a record
+    // carried over from the previous buffer.
+    std::vector<char> bytes;
+    std::size_t size = 0;
+  };
+
+  void
+  release(std::unique_ptr<Buffer> buffer)
+  {
+    if (!buffer) return;
+    {
+      std::lock_guard lock{ m_mutex };
+      m_free.push_back(std::move(buffer));
+    }
+    m_space.notify_one();
+  }
+
+  // Append read to the unconsumed bytes in the carry-over buffer, moving
+  // them there first if they are not in it yet. The consumed bytes at its
+  // front are only dropped once they make up half of it, so that every byte
+  // is moved a bounded number of times.
+  void
+  carry(std::string_view read)
+  {
+    if (!m_carried)
+      {
+        m_carry.assign(m_window.begin(), m_window.end());
+        m_carried = true;
+      }
+    else if (auto consumed = static_cast<std::size_t>(m_window.data()
+                                                      - m_carry.data());
+             consumed > m_carry.size() / 2)
+      m_carry.erase(m_carry.begin(), m_carry.begin() + consumed);
+
+    auto offset = m_carry.size() - m_window.size();
+    m_carry.insert(m_carry.end(), read.begin(), read.end());
+    m_window = { m_carry.data() + offset, m_carry.size() - offset };
+  }
+
+  void
+  readAhead()
+  {
+    while (true)
+      {
+        std::unique_ptr<Buffer> buffer{};
+        {
+          std::unique_lock lock{ m_mutex };
+          m_space.wait(lock, [this] { return m_stopped || !m_free.empty(); });
+          if (m_stopped) return;
+          buffer = std::move(m_free.front());
+          m_free.pop_front();
+        }
+
+        // Wait on the wake up pipe as well, so that the destructor does not
+        // block until the other end of fd writes something.
+        pollfd fds[] = { { m_fd, POLLIN, 0 }, { m_wake[0], POLLIN, 0 } };
+        ssize_t n = 0;
+        int error = 0;
+        while (true)
+          {
+            if (::poll(fds, 2, -1) < 0)
+              {
+                if (errno == EINTR) continue;
+                error = errno;
+                break;
+              }
+            if (fds[1].revents) return;
+            n = ::read(m_fd, buffer->bytes.data() + buffer->bytes.size()
+                                 - m_chunk, m_chunk);
+            if (n >= 0) break;
+            if (errno != EINTR && errno != EAGAIN)
+              {
+                error = errno;
+                break;
+              }
+          }
+
+        buffer->size = n > 0 ? static_cast<std::size_t>(n) : 0;
+        {
+          std::lock_guard lock{ m_mutex };
+          m_full.push_back(std::move(buffer));
+          m_error = error;
+        }
+        m_data.notify_one();
+        if (n <= 0) return;
+      }
+  }
+
+  int m_fd;
+  std::size_t m_chunk;
+  int m_wake[2];
+
+  // Consumer side.
+  std::unique_ptr<Buffer> m_current{};
+  std::string_view m_window{};
+  std::vector<char> m_carry{}; // Holds the window while m_carried.
+  bool m_carried = false;
+  bool m_done = false;
+
+  // Shared with the reader.
+  std::mutex m_mutex{};
+  std::condition_variable m_space{};
+  std::condition_variable m_data{};
+  std::deque<std::unique_ptr<Buffer> > m_free{};
+  std::deque<std::unique_ptr<Buffer> > m_full{};
+  int m_error = 0;
+  bool m_stopped = false;
+
+  std::thread m_reader{};
+};
+
+/**
+ * Parse the records of source that end with delimiter, e.g. lines, yielding
+ * each as soon as it has been read and parsed. p has to consume its whole
+ * record, which it sees without the delimiter, and the last record of the
+ * input does not need one.
+ *
+ * A record is a view into the buffers of source that stays valid until the
+ * next one is asked for.
+ */
+template <typename T>
+[[nodiscard]] Generator<ParseResult<T> >
+parseStream(Parser<T> p, FdSource& source, char delimiter)
+{
+  std::size_t searched = 0;
+  while (true)
+    {
+      auto window = source.window();
+      auto end = window.find(delimiter, searched);
+      if (end == std::string_view::npos)
+        {
+          searched = window.size();
+          if (source.fill()) continue;
+          if (window.empty()) co_return;
+          end = window.size();
+        }
+
+      auto result = p.run(window.substr(0, end));
+      if (result.isFailure())
+        {
+          co_yield std::move(result).asError();
+          co_return;
+        }
+      auto [value, remaining] = std::move(result).value();
+      if (!remaining.empty())
+        {
+          co_yield ParserError::create(p.getLabel(),
+                                       "Unexpected input after record");
+          co_return;
+        }
+
+      co_yield ParseResult<T>::success(std::move(value));
+      source.consume(std::min(end + 1, window.size()));
+      searched = 0;
+    }
+}
+
+} // namespace parsec
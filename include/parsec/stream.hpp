@@ -0,0 +1,231 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A lazy sequence of values produced by a coroutine, resumed each time the
+ * next value is asked for. It can be iterated over once.
+ */
+template <typename T>
+class Generator
+{
+public:
+  struct promise_type
+  {
+    std::optional<T> value{};
+    std::exception_ptr exception{};
+
+    Generator
+    get_return_object() noexcept
+    {
+      return Generator{ handle::from_promise(*this) };
+    }
+
+    std::suspend_always
+    initial_suspend() const noexcept
+    {
+      return {};
+    }
+
+    std::suspend_always
+    final_suspend() const noexcept
+    {
+      return {};
+    }
+
+    std::suspend_always
+    yield_value(T v) noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+      value.emplace(std::move(v));
+      return {};
+    }
+
+    void
+    return_void() const noexcept
+    {
+    }
+
+    void
+    unhandled_exception() noexcept
+    {
+      exception = std::current_exception();
+    }
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+
+  class iterator
+  {
+  public:
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() noexcept = default;
+
+    T&
+    operator*() const noexcept
+    {
+      return *m_coroutine.promise().value;
+    }
+
+    T*
+    operator->() const noexcept
+    {
+      return &*m_coroutine.promise().value;
+    }
+
+    iterator&
+    operator++()
+    {
+      m_coroutine.promise().value.reset();
+      resume(m_coroutine);
+      return *this;
+    }
+
+    void
+    operator++(int)
+    {
+      ++*this;
+    }
+
+    bool
+    operator==(std::default_sentinel_t) const noexcept
+    {
+      return !m_coroutine || m_coroutine.done();
+    }
+
+  private:
+    friend class Generator;
+
+    explicit iterator(handle coroutine) noexcept : m_coroutine{ coroutine } {}
+
+    handle m_coroutine{};
+  };
+
+  Generator(Generator&& other) noexcept
+      : m_coroutine{ std::exchange(other.m_coroutine, {}) }
+  {
+  }
+
+  Generator&
+  operator=(Generator&& other) noexcept
+  {
+    std::swap(m_coroutine, other.m_coroutine);
+    return *this;
+  }
+
+  ~Generator()
+  {
+    if (m_coroutine) m_coroutine.destroy();
+  }
+
+  /**
+   * Run the coroutine up to its first value.
+   * @throws The exception that escaped the coroutine, if any.
+   */
+  iterator
+  begin()
+  {
+    resume(m_coroutine);
+    return iterator{ m_coroutine };
+  }
+
+  std::default_sentinel_t
+  end() const noexcept
+  {
+    return {};
+  }
+
+private:
+  explicit Generator(handle coroutine) noexcept : m_coroutine{ coroutine } {}
+
+  static void
+  resume(handle coroutine)
+  {
+    coroutine.resume();
+    if (coroutine.promise().exception)
+      std::rethrow_exception(coroutine.promise().exception);
+  }
+
+  handle m_coroutine;
+};
+
+/**
+ * Parse the records of input one at a time, yielding each as soon as it has
+ * been parsed, so that memory is bounded by a single record rather than by
+ * the whole input as with many().
+ *
+ * The stream ends with the input, or right after yielding the error of a
+ * record that failed to parse. The input is not copied and has to outlive
+ * the stream.
+ */
+template <typename T, typename Input>
+[[nodiscard]] Generator<ParseResult<T> >
+parseStream(Parser<T, Input> p, std::type_identity_t<Input> input)
+{
+  while (!input.empty())
+    {
+      auto result = p.run(input);
+      if (result.isFailure())
+        {
+          co_yield std::move(result).asError();
+          co_return;
+        }
+
+      auto [value, remaining] = std::move(result).value();
+      // A record that consumes nothing would be yielded forever.
+      auto stuck = remaining.size() == input.size();
+      input = remaining;
+      co_yield ParseResult<T>::success(std::move(value));
+      if (stuck) co_return;
+    }
+}
+
+/**
+ * Parse the records of input separated by separator, e.g. lines, one at a
+ * time. The input may end with a separator, as files usually end with a
+ * line break. See parseStream(p, input).
+ */
+template <typename T, typename S, typename Input>
+[[nodiscard]] Generator<ParseResult<T> >
+parseStream(Parser<T, Input> p,
+            Parser<S, Input> separator,
+            std::type_identity_t<Input> input)
+{
+  while (!input.empty())
+    {
+      auto size = input.size();
+      auto result = p.run(input);
+      if (result.isFailure())
+        {
+          co_yield std::move(result).asError();
+          co_return;
+        }
+
+      auto [value, remaining] = std::move(result).value();
+      input = remaining;
+      co_yield ParseResult<T>::success(std::move(value));
+      if (input.empty()) co_return;
+
+      auto skipped = separator.run(input);
+      if (skipped.isFailure())
+        {
+          co_yield std::move(skipped).asError();
+          co_return;
+        }
+      input = skipped.value().second;
+      if (input.size() == size) co_return;
+    }
+}
+
+} // namespace parsec
@@ -0,0 +1,545 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ir.hpp"
+#include "parsec.hpp"
+
+namespace parsec
+{
+
+/**
+ * A parsing machine in the style of LPeg. A Program is compiled from the IR
+ * of a parser and run by a loop over a flat array of instructions, with an
+ * explicit stack for backtracking and calls instead of nested closures.
+ *
+ * The machine recognizes input: the values of parsers are not built. The
+ * only values it produces are the spans matched by consumed(), which are
+ * materialized once the whole match has succeeded.
+ */
+namespace vm
+{
+
+enum class Op : std::uint8_t
+{
+  Any,           // Consume one byte.
+  Char,          // Consume the byte arg.
+  Set,           // Consume a byte of sets[arg].
+  Span,          // Consume every byte of sets[arg].
+  String,        // Consume strings[arg].
+  Opaque,        // Run leaves[arg], a parser the machine cannot look into.
+  TestSet,       // Jump to target unless the next byte is in sets[arg].
+  Choice,        // Push a backtrack entry that resumes at target.
+  Commit,        // Pop the backtrack entry and jump to target.
+  PartialCommit, // Update the backtrack entry to here and jump to target.
+  Call,          // Push a return address and jump to target.
+  Return,        // Pop a return address and jump to it.
+  OpenCapture,   // Start a capture.
+  CloseCapture,  // End the innermost open capture.
+  End,           // Succeed.
+};
+
+struct Instruction
+{
+  Op op;
+  std::uint32_t arg = 0;
+  std::uint32_t target = 0;
+};
+
+/**
+ * The stacks of a running Program. A Machine can be reused by any number of
+ * programs, one after another or nested, so that after a warm up running a
+ * program does not allocate.
+ */
+class Machine
+{
+private:
+  friend class Program;
+
+  static constexpr std::uint32_t call
+      = std::numeric_limits<std::uint32_t>::max();
+
+  struct Entry
+  {
+    std::uint32_t pc;
+    std::uint32_t captures; // call for return addresses
+    std::size_t pos;
+  };
+
+  struct Capture
+  {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  std::vector<Entry> m_stack{};
+  std::vector<Capture> m_captures{};
+};
+
+class Program
+{
+public:
+  /**
+   * Compile the optimized IR of p. A parser without IR compiles into a
+   * single opaque instruction.
+   */
+  template <typename T>
+  explicit Program(const Parser<T>& p)
+  {
+    Assembler{ *this }.assemble(ir::optimize(detail::nodeOf(p)));
+  }
+
+  /**
+   * Run the program over a prefix of input. captures, if given, receives
+   * the spans matched by consumed(). A parser the machine cannot look into
+   * that reaches the DepthLimit throws its fatal ParserError.
+   * @return The length of the match, or std::nullopt if there is none.
+   */
+  std::optional<std::size_t>
+  run(std::string_view input,
+      Machine& machine,
+      std::vector<std::string_view>* captures = nullptr) const
+  {
+    auto& stack = machine.m_stack;
+    auto& caps = machine.m_captures;
+    const auto stackBase = stack.size();
+    const auto capsBase = caps.size();
+    constexpr auto open = std::numeric_limits<std::size_t>::max();
+
+    const auto* code = m_code.data();
+    const auto* data = input.data();
+    const auto size = input.size();
+    std::size_t pos = 0;
+    std::uint32_t pc = 0;
+
+    auto byte = [&](std::size_t i) {
+      return static_cast<unsigned char>(data[i]);
+    };
+
+    while (1)
+      {
+        const auto& in = code[pc];
+        switch (in.op)
+          {
+          case Op::Any:
+            if (pos >= size) break;
+            pos++;
+            pc++;
+            continue;
+          case Op::Char:
+            if (pos >= size || byte(pos) != in.arg) break;
+            pos++;
+            pc++;
+            continue;
+          case Op::Set:
+            if (pos >= size || !m_sets[in.arg][byte(pos)]) break;
+            pos++;
+            pc++;
+            continue;
+          case Op::Span:
+            {
+              const auto& set = m_sets[in.arg];
+              while (pos < size && set[byte(pos)]) pos++;
+              pc++;
+              continue;
+            }
+          case Op::String:
+            {
+              const auto& s = m_strings[in.arg];
+              if (!input.substr(pos).starts_with(s)) break;
+              pos += s.size();
+              pc++;
+              continue;
+            }
+          case Op::Opaque:
+            {
+              std::optional<std::string_view> rest{};
+              try
+                {
+                  rest = m_leaves[in.arg](input.substr(pos));
+                }
+              catch (...)
+                {
+                  // Leave the machine as it was, e.g. after a leaf threw
+                  // the fatal error of reaching the DepthLimit.
+                  stack.resize(stackBase);
+                  caps.resize(capsBase);
+                  throw;
+                }
+              if (!rest) break;
+              pos = size - rest->size();
+              pc++;
+              continue;
+            }
+          case Op::TestSet:
+            if (pos < size && m_sets[in.arg][byte(pos)])
+              pc++;
+            else
+              pc = in.target;
+            continue;
+          case Op::Choice:
+            stack.push_back(
+                { in.target, static_cast<std::uint32_t>(caps.size()), pos }
+            );
+            pc++;
+            continue;
+          case Op::Commit:
+            stack.pop_back();
+            pc = in.target;
+            continue;
+          case Op::PartialCommit:
+            {
+              // A repetition that consumed nothing would loop forever, so
+              // it ends instead.
+              auto& entry = stack.back();
+              if (entry.pos == pos)
+                {
+                  pc = entry.pc;
+                  stack.pop_back();
+                  continue;
+                }
+              entry.pos = pos;
+              entry.captures = static_cast<std::uint32_t>(caps.size());
+              pc = in.target;
+              continue;
+            }
+          case Op::Call:
+            stack.push_back({ pc + 1, Machine::call, 0 });
+            pc = in.target;
+            continue;
+          case Op::Return:
+            pc = stack.back().pc;
+            stack.pop_back();
+            continue;
+          case Op::OpenCapture:
+            caps.push_back({ pos, open });
+            pc++;
+            continue;
+          case Op::CloseCapture:
+            for (auto i = caps.size(); i-- > capsBase;)
+              if (caps[i].end == open)
+                {
+                  caps[i].end = pos;
+                  break;
+                }
+            pc++;
+            continue;
+          case Op::End:
+            if (captures)
+              for (auto i = capsBase; i < caps.size(); i++)
+                captures->push_back(
+                    input.substr(caps[i].begin, caps[i].end - caps[i].begin)
+                );
+            stack.resize(stackBase);
+            caps.resize(capsBase);
+            return pos;
+          }
+
+        // Backtrack to the most recent choice, dropping return addresses.
+        bool resumed = false;
+        while (stack.size() > stackBase)
+          {
+            auto entry = stack.back();
+            stack.pop_back();
+            if (entry.captures == Machine::call) continue;
+            pos = entry.pos;
+            caps.resize(entry.captures);
+            pc = entry.pc;
+            resumed = true;
+            break;
+          }
+        if (!resumed)
+          {
+            caps.resize(capsBase);
+            return std::nullopt;
+          }
+      }
+  }
+
+  /**
+   * Run the program with a machine of the calling thread.
+   */
+  std::optional<std::size_t>
+  run(std::string_view input,
+      std::vector<std::string_view>* captures = nullptr) const
+  {
+    thread_local Machine machine{};
+    return run(input, machine, captures);
+  }
+
+  [[nodiscard]] std::size_t
+  size() const noexcept
+  {
+    return m_code.size();
+  }
+
+  /**
+   * A listing of the instructions, one per line.
+   */
+  [[nodiscard]] std::string
+  disassemble() const
+  {
+    static constexpr const char* names[]
+        = { "any",    "char",          "set",  "span",   "string",
+            "opaque", "testset",       "choice", "commit", "partialcommit",
+            "call",   "return",        "opencapture",    "closecapture",
+            "end" };
+
+    std::string result{};
+    for (std::size_t pc = 0; pc < m_code.size(); pc++)
+      {
+        const auto& in = m_code[pc];
+        result += std::to_string(pc) + ": " + names[static_cast<int>(in.op)];
+        switch (in.op)
+          {
+          case Op::Char:
+            result += " " + ir::detail::showSet(
+                std::bitset<256>{}.set(in.arg)
+            );
+            break;
+          case Op::Set:
+          case Op::Span:
+            result += " " + ir::detail::showSet(m_sets[in.arg]);
+            break;
+          case Op::TestSet:
+            result += " " + ir::detail::showSet(m_sets[in.arg]) + " "
+                    + std::to_string(in.target);
+            break;
+          case Op::String:
+            result += " \"" + m_strings[in.arg] + "\"";
+            break;
+          case Op::Choice:
+          case Op::Commit:
+          case Op::PartialCommit:
+          case Op::Call:
+            result += " " + std::to_string(in.target);
+            break;
+          default:
+            break;
+          }
+        result += "\n";
+      }
+    return result;
+  }
+
+private:
+  // Emits the code of a graph. Nodes that the graph shares become
+  // subroutines, emitted once after the main code and called from every
+  // place that uses them.
+  class Assembler
+  {
+  public:
+    explicit Assembler(Program& program) : m_program{ program } {}
+
+    void
+    assemble(const ir::NodePtr& root)
+    {
+      count(root);
+      emit(root);
+      add(Op::End);
+
+      while (!m_pending.empty())
+        {
+          auto node = m_pending.back();
+          m_pending.pop_back();
+          m_rules[node.get()] = here();
+          body(node);
+          add(Op::Return);
+        }
+      for (auto [pc, node] : m_calls)
+        m_program.m_code[pc].target = m_rules[node];
+    }
+
+  private:
+    void
+    count(const ir::NodePtr& node)
+    {
+      if (m_uses[node.get()]++ > 0) return;
+      for (const auto& child : node->children) count(child);
+    }
+
+    std::uint32_t
+    here() const noexcept
+    {
+      return static_cast<std::uint32_t>(m_program.m_code.size());
+    }
+
+    std::uint32_t
+    add(Op op, std::uint32_t arg = 0, std::uint32_t target = 0)
+    {
+      m_program.m_code.push_back({ op, arg, target });
+      return here() - 1;
+    }
+
+    std::uint32_t
+    set(const std::bitset<256>& set)
+    {
+      m_program.m_sets.push_back(set);
+      return static_cast<std::uint32_t>(m_program.m_sets.size()) - 1;
+    }
+
+    void
+    emit(const ir::NodePtr& node)
+    {
+      auto shared = m_uses[node.get()] > 1;
+      auto composite = node->kind == ir::Kind::Sequence
+                    || node->kind == ir::Kind::Choice
+                    || node->kind == ir::Kind::Repeat;
+      if (!shared || !composite) return body(node);
+
+      if (!m_rules.contains(node.get()))
+        {
+          m_rules[node.get()] = 0;
+          m_pending.push_back(node);
+        }
+      m_calls.emplace_back(add(Op::Call), node.get());
+    }
+
+    void
+    body(const ir::NodePtr& node)
+    {
+      switch (node->kind)
+        {
+        case ir::Kind::Set:
+          if (node->set.all())
+            add(Op::Any);
+          else if (node->set.count() == 1)
+            {
+              std::uint32_t c = 0;
+              while (!node->set[c]) c++;
+              add(Op::Char, c);
+            }
+          else
+            add(Op::Set, set(node->set));
+          return;
+        case ir::Kind::Literal:
+          if (node->literal.size() == 1)
+            add(Op::Char, static_cast<unsigned char>(node->literal[0]));
+          else if (!node->literal.empty())
+            {
+              m_program.m_strings.push_back(node->literal);
+              add(Op::String,
+                  static_cast<std::uint32_t>(m_program.m_strings.size()) - 1);
+            }
+          return;
+        case ir::Kind::Sequence:
+          for (const auto& child : node->children) emit(child);
+          return;
+        case ir::Kind::Choice:
+          return choice(node);
+        case ir::Kind::Repeat:
+          return repeat(node);
+        case ir::Kind::Map:
+          return emit(node->children[0]);
+        case ir::Kind::Capture:
+          add(Op::OpenCapture);
+          emit(node->children[0]);
+          add(Op::CloseCapture);
+          return;
+        default:
+          m_program.m_leaves.push_back(*m_compiler.skip(node));
+          add(Op::Opaque,
+              static_cast<std::uint32_t>(m_program.m_leaves.size()) - 1);
+          return;
+        }
+    }
+
+    // Alternatives whose first byte is known are guarded by a test, so that
+    // no backtrack entry is pushed for those that cannot match.
+    void
+    choice(const ir::NodePtr& node)
+    {
+      std::vector<std::uint32_t> commits{};
+      for (std::size_t i = 0; i < node->children.size(); i++)
+        {
+          const auto& child = node->children[i];
+          if (i + 1 == node->children.size())
+            {
+              emit(child);
+              break;
+            }
+
+          std::vector<std::uint32_t> next{};
+          if (auto first = ir::first(child))
+            next.push_back(add(Op::TestSet, set(*first)));
+          next.push_back(add(Op::Choice));
+          emit(child);
+          commits.push_back(add(Op::Commit));
+          for (auto pc : next) m_program.m_code[pc].target = here();
+        }
+      for (auto pc : commits) m_program.m_code[pc].target = here();
+    }
+
+    void
+    repeat(const ir::NodePtr& node)
+    {
+      const auto& child = node->children[0];
+      if (child->kind == ir::Kind::Set)
+        {
+          auto span = set(child->set);
+          if (node->min > 0) add(Op::Set, span);
+          add(Op::Span, span);
+          return;
+        }
+
+      for (std::size_t i = 0; i < node->min; i++) emit(child);
+      auto choice = add(Op::Choice);
+      auto loop = here();
+      emit(child);
+      add(Op::PartialCommit, 0, loop);
+      m_program.m_code[choice].target = here();
+    }
+
+    Program& m_program;
+    ir::Compiler m_compiler{};
+    std::unordered_map<const ir::Node*, std::size_t> m_uses{};
+    std::unordered_map<const ir::Node*, std::uint32_t> m_rules{};
+    std::vector<ir::NodePtr> m_pending{};
+    std::vector<std::pair<std::uint32_t, const ir::Node*> > m_calls{};
+  };
+
+  std::vector<Instruction> m_code{};
+  std::vector<std::bitset<256> > m_sets{};
+  std::vector<std::string> m_strings{};
+  std::vector<ir::Skip> m_leaves{};
+};
+
+} // namespace vm
+
+/**
+ * Run p on the parsing machine. Its value is not built: the returned parser
+ * produces the spans captured by consumed() inside p, in order.
+ */
+template <typename T>
+[[nodiscard]] Parser<std::vector<std::string_view> >
+compile(const Parser<T>& p)
+{
+  using result_type = Parser<std::vector<std::string_view> >::result_type;
+  auto program = std::make_shared<const vm::Program>(p);
+  auto label = p.getLabel();
+  return Parser<std::vector<std::string_view> >(
+      label, [program, label](std::string_view input) -> result_type {
+        try
+          {
+            std::vector<std::string_view> captures{};
+            auto length = program->run(input, &captures);
+            if (!length) return ParserError::create(label, "Failed to parse");
+            return make_success(std::move(captures), input.substr(*length));
+          }
+        catch (const ParserError& error)
+          {
+            if (!error.isFatal()) throw;
+            return error;
+          }
+      });
+}
+
+} // namespace parsec
@@ -3,9 +3,32 @@
 //
 
 #include "parsec/adapter.hpp"
+#include "parsec/adaptive.hpp"
+#include "parsec/binary.hpp"
+#include "parsec/cache.hpp"
+#include "parsec/columns.hpp"
+#include "parsec/csv.hpp"
+#include "parsec/diagnostics.hpp"
+#include "parsec/expr.hpp"
+#include "parsec/incremental.hpp"
+#include "parsec/intern.hpp"
+#include "parsec/json.hpp"
+#include "parsec/lexer.hpp"
 #include "parsec/parsec.hpp"
-
+#include "parsec/parsers.hpp"
+#include "parsec/peg.hpp"
+#include "parsec/regex.hpp"
+#include "parsec/source.hpp"
+#include "parsec/stream.hpp"
+#include "parsec/utf8.hpp"
+#include "parsec/vm.hpp"
+
+#include <array>
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <pthread.h>
+#include <thread>
 
 using namespace parsec;
 
@@ -297,7 +320,31 @@ test_takeWhile_works_with_valid_input()
   auto result = parser.run("1234506789");
   assert(result.isSuccess());
   assert(result.value().first == std::vector({ '1', '2', '3', '4', '5' }));
-  assert(result.value().second == "6789");
+  assert(result.value().second == "06789");
+}
+
+void
+test_takeWhile_stops_at_the_end_of_the_input()
+{
+  auto parser = takeWhile([](char c) { return c == 'a'; });
+  auto result = parser.run("aaa");
+  assert(result.isSuccess());
+  assert(result.value().first == std::vector({ 'a', 'a', 'a' }));
+  assert(result.value().second == "");
+  assert(parser.run("").value().first.empty());
+}
+
+void
+test_takeWhile_works_over_spans()
+{
+  const int values[] = { 2, 4, 5, 6 };
+  auto parser
+      = takeWhile<std::span<const int> >([](int n) { return n % 2 == 0; });
+  auto result = parser.run(values);
+  assert(result.isSuccess());
+  assert(result.value().first == std::vector({ 2, 4 }));
+  assert(result.value().second.size() == 2);
+  assert(result.value().second[0] == 5);
 }
 
 void
@@ -306,7 +353,1467 @@ test_skipWhile_works_with_valid_input()
   auto parser = skipWhile([](char c) { return c != '0'; });
   auto result = parser.run("1234506789");
   assert(result.isSuccess());
-  assert(result.value().second == "6789");
+  assert(result.value().second == "06789");
+}
+
+void
+test_count_parses_exactly_n_ocurrences()
+{
+  auto parser = count(3, anyOf('a', 'o', 'c'));
+  auto result = parser.run("aocaoc");
+  assert(result.isSuccess());
+  assert(result.value().first == std::vector({ 'a', 'o', 'c' }));
+  assert(result.value().second == "aoc");
+}
+
+void
+test_count_fails_when_there_are_too_few_ocurrences()
+{
+  auto parser = count(4, charP('a'));
+  auto result = parser.run("aaa");
+  assert(result.isFailure());
+}
+
+void
+test_manyTill_stops_at_the_end_parser()
+{
+  auto parser = manyTill(anyOf('a', 'o', 'c', '-'), stringP("--"));
+  auto result = parser.run("a-oc--2022");
+  assert(result.isSuccess());
+  assert(result.value().first == std::list({ 'a', '-', 'o', 'c' }));
+  assert(result.value().second == "2022");
+}
+
+void
+test_manyTill_fails_when_end_is_never_found()
+{
+  auto parser = manyTill(charP('a'), charP(';'));
+  auto result = parser.run("aab;");
+  assert(result.isFailure());
+}
+
+void
+test_sepEndBy_accepts_an_optional_trailing_separator()
+{
+  auto parser = sepEndBy(anyOf('a', 'o', 'c'), charP(','));
+  auto result1 = parser.run("a,o,c,!");
+  auto result2 = parser.run("a,o,c!");
+  auto result3 = parser.run("!");
+
+  assert(result1.isSuccess() && result2.isSuccess() && result3.isSuccess());
+  assert(result1.value().first == std::list({ 'a', 'o', 'c' }));
+  assert(result1.value().second == "!");
+  assert(result2.value().first == std::list({ 'a', 'o', 'c' }));
+  assert(result2.value().second == "!");
+  assert(result3.value().first == std::list<char>());
+  assert(result3.value().second == "!");
+}
+
+void
+test_endBy_requires_a_separator_after_each_ocurrence()
+{
+  auto parser = endBy(anyOf('a', 'o', 'c'), charP(';'));
+  auto result = parser.run("a;o;c");
+  assert(result.isSuccess());
+  assert(result.value().first == std::list({ 'a', 'o' }));
+  assert(result.value().second == "c");
+
+  assert(endBy1(charP('a'), charP(';')).run("a").isFailure());
+}
+
+void
+test_between_returns_the_value_of_the_inner_parser()
+{
+  auto parser = between(charP('('), charP(')'), charP('a'));
+  auto result = parser.run("(a)oc");
+  assert(result.isSuccess());
+  assert(result.value().first == 'a');
+  assert(result.value().second == "oc");
+}
+
+void
+test_chainl1_folds_from_the_left()
+{
+  auto minus = charP('-') >> pure(std::function([](int a, int b) {
+                 return a - b;
+               }));
+  auto parser = chainl1(decimal(), minus);
+  auto result = parser.run("10-2-3;");
+  assert(result.isSuccess());
+  assert(result.value().first == 5);
+  assert(result.value().second == ";");
+}
+
+void
+test_chainr1_folds_from_the_right()
+{
+  auto minus = charP('-') >> pure(std::function([](int a, int b) {
+                 return a - b;
+               }));
+  auto parser = chainr1(decimal(), minus);
+  auto result = parser.run("10-2-3-;");
+  assert(result.isSuccess());
+  assert(result.value().first == 11);
+  assert(result.value().second == "-;");
+}
+
+void
+test_satisfy_works_over_other_inputs()
+{
+  auto parser = many1(satisfy<std::u16string_view>(
+      [](char16_t c) { return c == u'a'; }, "wide a"
+  ));
+  auto result = parser.run(u"aac");
+  assert(result.isSuccess());
+  assert(result.value().first == std::list<char16_t>({ u'a', u'a' }));
+  assert(result.value().second == u"c");
+}
+
+void
+test_fixed_width_integers_honor_byte_order()
+{
+  auto input = std::string_view("\x01\x02\x03\x04\x05", 5);
+
+  assert(u8().run(input).value().first == 0x01);
+  assert(u16le().run(input).value().first == 0x0201);
+  assert(u16be().run(input).value().first == 0x0102);
+  assert(u32le().run(input).value().first == 0x04030201);
+  assert(u32be().run(input).value().first == 0x01020304);
+  assert(u32be().run(input).value().second == "\x05");
+  assert(u64le().run(input).isFailure());
+}
+
+void
+test_f64le_decodes_a_double()
+{
+  double expected = 3.5;
+  std::array<std::byte, sizeof(double)> bytes{};
+  std::memcpy(bytes.data(), &expected, sizeof(double));
+  if constexpr (std::endian::native == std::endian::big)
+    std::reverse(bytes.begin(), bytes.end());
+
+  auto result = f64le().run(fromBytes(bytes));
+  assert(result.isSuccess());
+  assert(result.value().first == expected);
+  assert(result.value().second.empty());
+}
+
+void
+test_varint_decodes_multi_byte_values()
+{
+  auto result = varint().run(std::string_view("\xac\x02!", 3));
+  assert(result.isSuccess());
+  assert(result.value().first == 300);
+  assert(result.value().second == "!");
+
+  assert(varint().run(std::string_view("\xac", 1)).isFailure());
+}
+
+void
+test_lengthPrefixed_runs_the_parser_over_the_frame()
+{
+  auto parser = lengthPrefixed(u8(), many(anyChar()));
+  auto result = parser.run(std::string_view("\x03" "aocxyz", 7));
+  assert(result.isSuccess());
+  assert(result.value().first == std::list({ 'a', 'o', 'c' }));
+  assert(result.value().second == "xyz");
+
+  assert(parser.run(std::string_view("\x09" "aoc", 4)).isFailure());
+  assert(lengthPrefixed(u8(), takeN(2)).run("\x03" "aoc").isFailure());
+}
+
+void
+test_seq_into_constructs_an_aggregate()
+{
+  struct S
+  {
+    char a, b, c;
+  };
+
+  auto parser = seq(charP('a'),
+                    charP(' ') >> charP('b'),
+                    charP(' ') >> charP('c'))
+                    .into<S>();
+  auto result = parser.run("a b c");
+
+  assert(result.isSuccess());
+  assert(result.value().first.a == 'a');
+  assert(result.value().first.b == 'b');
+  assert(result.value().first.c == 'c');
+  assert(parser.run("a b").isFailure());
+}
+
+void
+test_seq_apply_calls_the_function_with_every_value()
+{
+  struct Person : public all_args_factory<Person, std::string, int>
+  {
+    const std::string name;
+    const int age;
+  };
+
+  auto wordP = many1(letter()) & convert::tostring();
+  auto parser = seq(wordP < charP(' '), decimal()).apply(&Person::init);
+  auto result = parser.run("Alexander 23");
+
+  assert(result.isSuccess());
+  assert(result.value().first.name == "Alexander");
+  assert(result.value().first.age == 23);
+}
+
+void
+test_construct_uses_the_constructor_of_the_type()
+{
+  auto parser = construct<std::string>(decimal(), anyChar());
+  auto result = parser.run("3a!");
+  assert(result.isSuccess());
+  assert(result.value().first == "aaa");
+  assert(result.value().second == "!");
+}
+
+void
+test_map_and_sequencing_move_values_instead_of_copying_them()
+{
+  auto boxed = [](char c) {
+    return std::make_unique<char>(c);
+  };
+  auto parser = many1(boxed % charP('a') < charP(','));
+
+  auto result = parser.run("a,a,b");
+
+  assert(result.isSuccess());
+  assert(result.value().first.size() == 2);
+  assert(*result.value().first.front() == 'a');
+  assert(result.value().second == "b");
+}
+
+void
+test_skipMany_counts_the_ocurrences()
+{
+  auto result = skipMany(charP('a')).run("aaab");
+  assert(result.isSuccess());
+  assert(result.value().first == 3);
+  assert(result.value().second == "b");
+}
+
+void
+test_skipSepBy_counts_the_ocurrences()
+{
+  auto parser = skipSepBy(charP('a'), charP(','));
+  auto result1 = parser.run("a,a,a,b");
+  auto result2 = parser.run("b");
+  assert(result1.isSuccess() && result2.isSuccess());
+  assert(result1.value().first == 3);
+  assert(result1.value().second == ",b");
+  assert(result2.value().first == 0);
+}
+
+void
+test_json_reader_parses_nested_documents()
+{
+  json::Reader reader{};
+  auto input = R"( {"hello": 12, "world": {"nested": [null, true, -1.5e2]},
+                    "empty": [], "text": "a\"b\u00e9\ud83d\ude00"} )";
+
+  auto result = reader.parse(input);
+
+  assert(result.isSuccess());
+  auto root = result.value();
+  assert(root.isObject());
+  assert(root.size() == 4);
+  assert(root["hello"].asInteger() == 12);
+  assert(root["world"]["nested"].size() == 3);
+  assert(root["world"]["nested"][0].isNull());
+  assert(root["world"]["nested"][1].asBool());
+  assert(root["world"]["nested"][2].asDouble() == -150.0);
+  assert(root["empty"].size() == 0);
+  assert(root["text"].asString() == "a\"b\xc3\xa9\xf0\x9f\x98\x80");
+  assert(!root.find("missing"));
+  assert(root.toString()
+         == R"({"hello":12,"world":{"nested":[null,true,-150]},)"
+            R"("empty":[],"text":"a\"b)"
+            "\xc3\xa9\xf0\x9f\x98\x80\"}");
+}
+
+void
+test_json_reader_strings_point_into_the_input()
+{
+  json::Reader reader{};
+  std::string_view input = R"(["abc"])";
+
+  auto result = reader.parse(input);
+
+  assert(result.isSuccess());
+  assert(result.value()[0].asString().data() == input.data() + 2);
+}
+
+void
+test_json_reader_rejects_invalid_documents()
+{
+  json::Reader reader{ 3 };
+
+  assert(reader.parse("").isFailure());
+  assert(reader.parse("[1,]").isFailure());
+  assert(reader.parse("{\"a\" 1}").isFailure());
+  assert(reader.parse("[1] x").isFailure());
+  assert(reader.parse("\"\\x\"").isFailure());
+  assert(reader.parse("01").isFailure());
+  assert(reader.parse("[[[[]]]]").isFailure());
+  assert(reader.parse("[[[1]]]").isSuccess());
+}
+
+void
+test_json_reader_values_compose_with_other_parsers()
+{
+  json::Reader reader{};
+  auto parser = sepBy(reader.value(), charP('\n'));
+
+  auto result = parser.run("1\n{\"a\":[2]}\n\"x\"");
+
+  assert(result.isSuccess());
+  assert(result.value().first.size() == 3);
+  assert(result.value().first.back().asString() == "x");
+  assert(result.value().first.front().asInteger() == 1);
+}
+
+void
+test_csv_reader_splits_records_and_fields()
+{
+  auto input = "name,age\r\n"
+               "\"Smith, John\",42\n"
+               "\"say \"\"hi\"\"\",\"multi\nline\"\n"
+               ",\n";
+  csv::Reader reader{ input };
+  csv::Row row{};
+
+  assert(reader.next(row));
+  assert(row.size() == 2 && row[0] == "name" && row[1] == "age");
+
+  assert(reader.next(row));
+  assert(row.size() == 2 && row[0] == "Smith, John");
+  assert(row.parse(1, decimal()).value() == 42);
+  assert(row.parse(0, decimal()).isFailure());
+
+  assert(reader.next(row));
+  assert(row[0] == "say \"hi\"" && row[1] == "multi\nline");
+
+  assert(reader.next(row));
+  assert(row.size() == 2 && row[0].empty() && row[1].empty());
+
+  assert(!reader.next(row));
+}
+
+void
+test_csv_reader_handles_fields_longer_than_a_block()
+{
+  std::string wide{};
+  for (int i = 0; i < 100; i++) wide += std::to_string(i) + "\t";
+  wide += "last";
+
+  std::size_t fields = 0;
+  auto rows = csv::forEachRow(
+      wide,
+      [&](const csv::Row& row) {
+        fields = row.size();
+        assert(row[99] == "99");
+        assert(row[100] == "last");
+      },
+      csv::tab
+  );
+
+  assert(rows == 1);
+  assert(fields == 101);
+}
+
+void
+test_csv_reader_rejects_malformed_quoted_fields()
+{
+  csv::Row row{};
+  bool threw = false;
+  try
+    {
+      csv::Reader reader{ "a,\"b" };
+      reader.next(row);
+    }
+  catch (const ParserError&)
+    {
+      threw = true;
+    }
+  assert(threw);
+}
+
+void
+test_consumed_returns_the_consumed_input()
+{
+  auto parser = consumed(many1(letter()) >> charP('1'));
+  auto result = parser.run("abc1;");
+  assert(result.isSuccess());
+  assert(result.value().first == "abc1");
+  assert(result.value().second == ";");
+}
+
+void
+test_intern_maps_repeated_names_to_the_same_symbol()
+{
+  SymbolTable table{};
+  auto parser = sepBy(intern(many1(letter()), table), charP(' '));
+
+  auto result = parser.run("foo bar foo");
+
+  assert(result.isSuccess());
+  auto symbols = std::vector(result.value().first.begin(),
+                             result.value().first.end());
+  assert(symbols.size() == 3);
+  assert(symbols[0] == symbols[2]);
+  assert(symbols[0].id != symbols[1].id);
+  assert(symbols[1].name == "bar");
+  assert(table.size() == 2);
+  assert(table.name(symbols[0].id) == "foo");
+}
+
+void
+test_concurrent_symbol_table_can_be_shared_across_threads()
+{
+  ConcurrentSymbolTable table{};
+  auto parser = many(intern(many1(letter()), table) < many(space()));
+
+  std::vector<std::thread> threads{};
+  for (int i = 0; i < 4; i++)
+    threads.emplace_back([&] {
+      for (int j = 0; j < 100; j++)
+        assert(parser.run("alpha beta gamma beta").isSuccess());
+    });
+  for (auto& thread : threads) thread.join();
+
+  assert(table.size() == 3);
+  assert(table.find("gamma"));
+  assert(!table.find("delta"));
+}
+
+void
+test_expression_honors_precedence_and_associativity()
+{
+  auto table = OperatorTable<int>{
+    { prefix<int>(charP('-'), std::negate<>{}),
+      postfix<int>(charP('!'),
+                   [](int n) {
+                     int result = 1;
+                     for (int i = 2; i <= n; i++) result *= i;
+                     return result;
+                   }) },
+    { infixr<int>(charP('^'),
+                  [](int a, int b) {
+                    int result = 1;
+                    while (b-- > 0) result *= a;
+                    return result;
+                  }) },
+    { infixl<int>(charP('*'), std::multiplies<>{}),
+      infixl<int>(charP('/'), std::divides<>{}) },
+    { infixl<int>(charP('+'), std::plus<>{}),
+      infixl<int>(charP('-'), std::minus<>{}) },
+    { infixn<int>(charP('<'), std::less<>{}) },
+  };
+
+  auto expr = recursive<int>([&table](const Parser<int>& self) {
+    return expression(between(charP('('), charP(')'), self) | decimal(),
+                      table);
+  });
+
+  assert(expr.runThrowing("1+2*3") == 7);
+  assert(expr.runThrowing("10-4-3") == 3);
+  assert(expr.runThrowing("2^3^2") == 512);
+  assert(expr.runThrowing("-2*3!") == -12);
+  assert(expr.runThrowing("(1+2)*3") == 9);
+  assert(expr.runThrowing("2*(3-(4/2))") == 2);
+  assert(expr.runThrowing("1+2<2*2") == 1);
+
+  auto result = expr.run("1+2*;");
+  assert(result.isSuccess());
+  assert(result.value().first == 3);
+  assert(result.value().second == "*;");
+
+  assert(expr.run("1<2<3").isFailure());
+}
+
+enum TokenKind : std::uint32_t
+{
+  LetToken,
+  IdentifierToken,
+  NumberToken,
+  OperatorToken,
+  OpenToken,
+  CloseToken,
+};
+
+Lexer
+test_lexer()
+{
+  return Lexer{ {
+      { Lexer::skip, "\\s+" },
+      { Lexer::skip, "//[^\\n]*" },
+      { LetToken, "let" },
+      { IdentifierToken, "[a-zA-Z_]\\w*" },
+      { NumberToken, "\\d+" },
+      { OperatorToken, "[-+*/=;]" },
+      { OpenToken, "\\(" },
+      { CloseToken, "\\)" },
+  } };
+}
+
+void
+test_lexer_splits_input_into_tokens()
+{
+  auto lexer = test_lexer();
+  auto tokens = lexer.tokenize("let letter = 42; // answer\n").value();
+  assert(tokens.size() == 5);
+  assert(tokens[0].kind == LetToken && tokens[0].text == "let");
+  assert(tokens[1].kind == IdentifierToken && tokens[1].text == "letter");
+  assert(tokens[2].kind == OperatorToken && tokens[2].text == "=");
+  assert(tokens[3].kind == NumberToken && tokens[3].text == "42");
+  assert(tokens[4].kind == OperatorToken && tokens[4].text == ";");
+
+  auto result = lexer.tokenize("x = @");
+  assert(result.isFailure());
+  assert(result.asError().show() == "lexer: No rule matches at offset 4");
+}
+
+void
+test_lexer_patterns_support_quantifiers_and_alternation()
+{
+  auto bounded = Lexer{ { { 0, "a{2,3}" } } }.tokenize("aaaaa").value();
+  assert(bounded.size() == 2);
+  assert(bounded[0].text == "aaa" && bounded[1].text == "aa");
+
+  auto alternation
+      = Lexer{ { { 0, "(ab|cd)+x?" }, { 1, "[^a-d]" } } }.tokenize("abcdxcdy");
+  assert(alternation.value().size() == 3);
+  assert(alternation.value()[0].text == "abcdx");
+  assert(alternation.value()[1].text == "cd");
+  assert(alternation.value()[2].kind == 1);
+
+  auto hex = Lexer{ { { 0, "\\x41+" } } }.tokenize("AAA").value();
+  assert(hex.size() == 1 && hex[0].text == "AAA");
+
+  bool threw = false;
+  try
+    {
+      Lexer{ { { 0, "(ab" } } };
+    }
+  catch (const ParserError&)
+    {
+      threw = true;
+    }
+  assert(threw);
+}
+
+void
+test_parsers_run_over_tokens()
+{
+  auto lexer = test_lexer();
+  std::vector<Token> buffer{};
+  auto tokens = lexer.tokenize("2 * (3 + 4) - 1", buffer).value();
+
+  auto op = [](std::string_view text) {
+    return keyword(OperatorToken, text);
+  };
+  auto table = OperatorTable<int, Tokens>{
+    { infixl<int>(op("*"), std::multiplies<>{}) },
+    { infixl<int>(op("+"), std::plus<>{}),
+      infixl<int>(op("-"), std::minus<>{}) },
+  };
+  auto number = map([](Token t) { return std::stoi(std::string(t.text)); },
+                    token(NumberToken, "number"));
+  auto expr = recursive<int, Tokens>([&](const Parser<int, Tokens>& self) {
+    auto parenthesized = between(token(OpenToken), token(CloseToken), self);
+    return expression(parenthesized | number, table);
+  });
+
+  auto result = expr.run(tokens);
+  assert(result.isSuccess());
+  assert(result.value().first == 13);
+  assert(result.value().second.empty());
+}
+
+void
+test_regex_matches_the_longest_prefix()
+{
+  auto ipv4 = regex("[0-9]{1,3}(\\.[0-9]{1,3}){3}");
+  auto result = ipv4.run("192.168.0.1:80");
+  assert(result.isSuccess());
+  assert(result.value().first == "192.168.0.1");
+  assert(result.value().second == ":80");
+  assert(ipv4.run("192.168.0").isFailure());
+
+  auto uuid = regex("[0-9a-f]{8}(-[0-9a-f]{4}){3}-[0-9a-f]{12}");
+  auto ids = sepBy(uuid, charP(','));
+  auto parsed = ids.run("123e4567-e89b-12d3-a456-426614174000,"
+                        "00000000-0000-0000-0000-000000000000");
+  assert(parsed.isSuccess() && parsed.value().first.size() == 2);
+  assert(parsed.value().second.empty());
+
+  auto optional = regex("a*");
+  assert(optional.run("b").isSuccess());
+  assert(optional.run("b").value().first.empty());
+
+  // Repetition counts apply to the quantified atom, not just the atom.
+  auto stacked = regex("a?{2}b");
+  assert(stacked.run("b").isSuccess());
+  assert(stacked.run("aab").value().first == "aab");
+  assert(stacked.run("aaab").isFailure());
+  assert(regex("a+{2}").run("aaa").value().first == "aaa");
+  assert(regex("a+{2}").run("a").isFailure());
+}
+
+void
+test_regex_rejects_hostile_patterns()
+{
+  auto rejected = [](auto compile) {
+    try
+      {
+        compile();
+      }
+    catch (const ParserError&)
+      {
+        return true;
+      }
+    return false;
+  };
+  assert(rejected([] { Lexer{ {} }; }));
+  assert(rejected([] { regex("a{1000000}"); }));
+  assert(rejected([] { regex("(a{1000}){1000}"); }));
+  // The DFA needs a state for each of the last 16 letters.
+  assert(rejected([] { regex("(a|b)*a(a|b){15}"); }));
+  assert(!rejected([] { regex("(a|b)*a(a|b){3}"); }));
+}
+
+void
+test_regex_runs_in_compiled_parsers()
+{
+  auto pair = consumed(regex("[a-z]+")) < charP('=') >> regex("[0-9]+");
+  auto result = compile(pair).run("key=42;");
+  assert(result.isSuccess());
+  assert((result.value().first == std::vector<std::string_view>{ "key" }));
+  assert(result.value().second == ";");
+
+  bool threw = false;
+  try
+    {
+      regex("[a-");
+    }
+  catch (const ParserError&)
+    {
+      threw = true;
+    }
+  assert(threw);
+}
+
+void
+test_ascii_classifiers_ignore_the_locale()
+{
+  assert(digit().run("7").isSuccess());
+  assert(letter().run("Q").isSuccess());
+  assert(space().run("\v").isSuccess());
+  assert(letter().run("\xC3\xA9").isFailure());
+  assert(digit().run("a").isFailure());
+  assert(space().run("_").isFailure());
+}
+
+void
+test_utf8_parsers_decode_code_points()
+{
+  auto word = many1(unicodeLetter());
+  auto result = word.run("Ж\xC3\xA9t\xE8\xAA\x9E\xF0\x9F\x98\x80");
+  assert(result.isSuccess());
+  assert((result.value().first
+          == std::list<char32_t>{ U'Ж', U'é', U't', U'語' }));
+  assert(result.value().second == "\xF0\x9F\x98\x80");
+
+  auto emoji = utf8Char().run(result.value().second);
+  assert(emoji.isSuccess() && emoji.value().first == U'\U0001F600');
+
+  assert(unicodeLetter().run("\xC3\x97").isFailure()); // U+00D7 ×
+  assert(utf8Char().run("\xC0\x80").isFailure());     // Overlong
+  assert(utf8Char().run("\xED\xA0\x80").isFailure()); // Surrogate
+  assert(utf8Char().run("\xE8\xAA").isFailure());     // Truncated
+}
+
+void
+test_utf8_validates_the_input_up_front()
+{
+  std::string ascii(100, 'a');
+  assert(utf8Prefix(ascii) == ascii.size());
+  assert(utf8Prefix(ascii + "\xC3\xA9" + ascii) == 2 * ascii.size() + 2);
+  assert(utf8Prefix(ascii + "\xFF" + ascii) == ascii.size());
+
+  auto words = utf8(sepBy(many1(unicodeLetter()), charP(' ')));
+  assert(words.run("na\xC3\xAFve caf\xC3\xA9").isSuccess());
+  auto invalid = words.run("caf\xC3");
+  assert(invalid.isFailure());
+  assert(std::move(invalid).asError().show().find("offset 3")
+         != std::string::npos);
+}
+
+void
+test_skipUntil_skips_past_the_end_parser()
+{
+  auto parser = skipUntil(charP(';'));
+  auto result = parser.run("abc;d");
+  assert(result.isSuccess());
+  assert(result.value().first == 3);
+  assert(result.value().second == "d");
+
+  result = parser.run("abc");
+  assert(result.isSuccess());
+  assert(result.value().first == 3);
+  assert(result.value().second.empty());
+}
+
+void
+test_recover_collects_every_error_in_one_pass()
+{
+  std::string_view input = "a:1\nb:x\nc:3\n??\nd:4\n";
+  auto record = letter() >> charP(':') >> decimal() < charP('\n');
+
+  Diagnostics diagnostics{ input };
+  auto records = many(recover(record, skipUntil(charP('\n')), diagnostics));
+  auto result = records.run(input);
+  assert(result.isSuccess());
+  assert(result.value().second.empty());
+
+  auto values = std::vector(result.value().first.begin(),
+                            result.value().first.end());
+  assert(values.size() == 5);
+  assert(values[0] == 1 && !values[1] && values[2] == 3 && !values[3]
+         && values[4] == 4);
+
+  assert(diagnostics.size() == 2);
+  assert(diagnostics[0].offset == 4);
+  assert(diagnostics[1].offset == 12);
+
+  Diagnostics limited{ input, 1 };
+  auto result2
+      = many(recover(record, skipUntil(charP('\n')), limited)).run(input);
+  assert(result2.value().first.size() == 3);
+  assert(result2.value().second == "??\nd:4\n");
+  assert(limited.size() == 1);
+}
+
+void
+test_recover_errors_are_forgotten_when_a_transaction_fails()
+{
+  std::string_view input = "x;y";
+  Diagnostics diagnostics{ input };
+  auto item = recover(decimal(), skipUntil(charP(';')), diagnostics);
+  auto whole = stringP("x;y");
+
+  // Errors that a choice backtracks over are left behind, unless the
+  // branch runs as a transaction.
+  auto loose = (item >> charP('.') >> whole) | whole;
+  assert(loose.run(input).isSuccess());
+  assert(diagnostics.size() == 1);
+
+  diagnostics.reset(input);
+  auto strict = transaction(diagnostics, item >> charP('.') >> whole) | whole;
+  assert(strict.run(input).isSuccess());
+  assert(diagnostics.empty());
+
+  auto kept = transaction(diagnostics, item >> letter());
+  assert(kept.run(input).isSuccess());
+  assert(diagnostics.size() == 1 && diagnostics[0].offset == 0);
+}
+
+void
+test_optimize_fuses_characters_into_literals()
+{
+  auto parser = optimize(charP('a') >> charP('b') >> charP('c'));
+  assert(ir::show(parser.node()) == "(seq 1 \"ab\" 'c')");
+
+  auto result = parser.run("abcd");
+  assert(result.isSuccess());
+  assert(result.value().first == 'c');
+  assert(result.value().second == "d");
+  assert(parser.run("abd").isFailure());
+}
+
+void
+test_optimize_scans_repeated_characters_in_bulk()
+{
+  auto parser = optimize(many(digit()) < charP(';'));
+  assert(ir::show(parser.node()) == "(seq 0 (many [0-9]) ';')");
+
+  auto result = parser.run("123;");
+  assert(result.isSuccess());
+  assert(std::string(result.value().first.begin(), result.value().first.end())
+         == "123");
+  assert(result.value().second.empty());
+  assert(parser.run("12a").isFailure());
+  assert(optimize(many1(digit())).run("a").isFailure());
+}
+
+void
+test_optimize_left_factors_alternatives()
+{
+  auto original = stringP("true") | stringP("trie") | stringP("false")
+                | stringP("tr");
+  auto parser = optimize(original);
+  assert(ir::show(parser.node())
+         == "(alt (seq 1 \"tr\" (alt \"ue\" \"ie\")) \"false\" \"tr\")");
+
+  for (auto input : { "true", "trie", "false", "tr", "trx", "x", "" })
+    {
+      auto expected = original.run(input);
+      auto result = parser.run(input);
+      assert(result.isSuccess() == expected.isSuccess());
+      if (expected.isSuccess()) assert(result.value() == expected.value());
+    }
+}
+
+void
+test_optimize_shares_identical_sub_parsers()
+{
+  auto number = map([](auto digits) { return digits.size(); }, many1(digit()));
+  auto parser = optimize((many1(digit()) < charP(',')) >> number);
+  const auto& node = parser.node();
+  assert(node->kind == ir::Kind::Sequence);
+  assert(node->children.size() == 3);
+  assert(node->children[0] == node->children[2]->children[0]);
+
+  auto result = parser.run("12,345");
+  assert(result.isSuccess());
+  assert(result.value().first == 3);
+}
+
+void
+test_recognize_builds_no_values()
+{
+  int calls = 0;
+  auto number = digits() & [&calls](const std::string& digits) {
+    calls++;
+    return std::stoi(digits);
+  };
+  auto numbers = sepBy(number, charP(','));
+
+  assert(numbers.recognize("1,22,333;") == std::size_t{ 8 });
+  assert(numbers.recognize("") == std::size_t{ 0 });
+  assert(!number.recognize("x"));
+  assert(numbers.validate("1,22,333"));
+  assert(!numbers.validate("1,22,333;"));
+  assert(calls == 0);
+
+  assert(numbers.run("1,22").isSuccess());
+  assert(calls == 2);
+}
+
+void
+test_recognize_runs_parsers_of_unknown_structure()
+{
+  auto doubled = anyChar() >>= [](char c) { return charP(c); };
+  auto pairs = many(doubled) < charP(';');
+  assert(pairs.recognize("aabb;") == std::size_t{ 5 });
+  assert(!pairs.recognize("ab;"));
+
+  auto tokens = Lexer{ { { 0, "[a-z]+" }, { Lexer::skip, " +" } } }
+                    .tokenize("ab cd")
+                    .value();
+  assert(many(token(0)).validate(tokens));
+}
+
+void
+test_compiled_parsers_match_like_the_original()
+{
+  auto key = many1(letter());
+  auto value = stringP("true") | stringP("false") | digits();
+  auto pair = key >> charP('=') >> value;
+  auto pairs = sepBy(pair, charP(','));
+  auto compiled = compile(pairs);
+
+  for (auto input : { "a=1,b=true,c=false", "a=1,b=tru", "x", "", "a=,b=2" })
+    {
+      auto expected = pairs.run(input);
+      auto result = compiled.run(input);
+      assert(result.isSuccess() == expected.isSuccess());
+      if (expected.isSuccess())
+        assert(result.value().second == expected.value().second);
+    }
+}
+
+void
+test_compiled_parsers_return_the_captures()
+{
+  auto words = many(consumed(many1(letter())) < many(space()));
+  auto result = compile(words).run("ab cd  ef!");
+  assert(result.isSuccess());
+  assert((result.value().first
+          == std::vector<std::string_view>{ "ab", "cd", "ef" }));
+  assert(result.value().second == "!");
+
+  auto backtracking = (consumed(stringP("ab")) >> charP('x'))
+                    | (consumed(stringP("a")) >> charP('b'));
+  auto captures = compile(backtracking).run("ab");
+  assert(captures.isSuccess());
+  assert((captures.value().first == std::vector<std::string_view>{ "a" }));
+}
+
+void
+test_compiled_parsers_call_shared_rules_and_opaque_parsers()
+{
+  auto number = many1(digit()) >> many(charP('_') >> many1(digit()));
+  auto sign = charP('-') >>= [](char c) { return pure(c); };
+  auto range
+      = number >> charP('.') >> charP('.') >> ((sign >> number) | number);
+
+  vm::Program program{ range };
+  assert(program.disassemble().find("call") != std::string::npos);
+  assert(program.disassemble().find("opaque") != std::string::npos);
+
+  assert(program.run("1_000..20") == std::size_t{ 9 });
+  assert(program.run("1..-5") == std::size_t{ 5 });
+  assert(!program.run("1.2"));
+}
+
+void
+test_parseStream_yields_records_one_at_a_time()
+{
+  auto records = parseStream(decimal() < charP(';'), "1;22;333;");
+  auto it = records.begin();
+  assert(it != records.end() && it->value() == 1);
+  ++it;
+  assert(it != records.end() && it->value() == 22);
+  ++it;
+  assert(it != records.end() && it->value() == 333);
+  ++it;
+  assert(it == records.end());
+
+  std::vector<std::string> lines{};
+  for (auto& line : parseStream(many1(letter()) & [](auto letters) {
+                                  return std::string(letters.begin(),
+                                                     letters.end());
+                                },
+                                charP('\n'), "ab\ncd\nef\n"))
+    lines.push_back(std::move(line).value());
+  assert((lines == std::vector<std::string>{ "ab", "cd", "ef" }));
+}
+
+void
+test_parseStream_stops_after_an_error()
+{
+  std::vector<bool> results{};
+  for (const auto& record : parseStream(digit(), charP(','), "1,2,x,3"))
+    results.push_back(record.isSuccess());
+  assert((results == std::vector<bool>{ true, true, false }));
+
+  std::size_t count = 0;
+  for (const auto& record : parseStream(many(digit()), "ab"))
+    {
+      assert(record.isSuccess());
+      count++;
+    }
+  assert(count == 1);
+}
+
+void
+test_fd_source_parses_records_across_reads()
+{
+  int fds[2];
+  [[maybe_unused]] auto piped = ::pipe(fds);
+  assert(piped == 0);
+  std::thread writer{ [fd = fds[1]] {
+    std::string input{};
+    for (int i = 0; i < 1000; i++)
+      {
+        input += std::to_string(i) + "\n";
+        if (i == 500) input += std::string(1000, '5') + "\n";
+      }
+    input += std::string(100, '7');
+    for (std::size_t i = 0; i < input.size(); i += 7)
+      {
+        auto n = std::min<std::size_t>(7, input.size() - i);
+        [[maybe_unused]] auto written = ::write(fd, input.data() + i, n);
+        assert(written == static_cast<ssize_t>(n));
+      }
+    ::close(fd);
+  } };
+
+  std::vector<std::string> records{};
+  {
+    // Records longer than a chunk are gathered in a buffer of their own.
+    FdSource source{ fds[0], 16, 2 };
+    for (auto& record : parseStream(digits(), source, '\n'))
+      records.push_back(std::move(record).value());
+  }
+  writer.join();
+  ::close(fds[0]);
+
+  assert(records.size() == 1002);
+  assert(records[0] == "0" && records[1000] == "999");
+  assert(records[501] == std::string(1000, '5'));
+  assert(records[502] == "501");
+  assert(records[1001] == std::string(100, '7'));
+}
+
+void
+test_fd_source_stops_without_waiting_for_input()
+{
+  int fds[2];
+  [[maybe_unused]] auto piped = ::pipe(fds);
+  assert(piped == 0);
+  [[maybe_unused]] auto written = ::write(fds[1], "12\nab\n", 6);
+  assert(written == 6);
+  {
+    FdSource source{ fds[0] };
+    std::vector<bool> results{};
+    for (const auto& record : parseStream(digits(), source, '\n'))
+      results.push_back(record.isSuccess());
+    assert((results == std::vector<bool>{ true, false }));
+  }
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+void
+test_cached_reuses_values_of_repeated_fragments()
+{
+  int runs = 0;
+  auto field = many1(letter()) & [&runs](const auto& letters) {
+    runs++;
+    return std::string(letters.begin(), letters.end());
+  };
+  ResultCache<std::string> cache{ 2 };
+  auto fields = sepBy(cached(field, cache), charP(','));
+
+  auto result = fields.run("get,put,get,get,put");
+  assert(result.isSuccess());
+  assert((result.value().first
+          == std::list<std::string>{ "get", "put", "get", "get", "put" }));
+  // The last "put" ends the input, unlike the first one.
+  assert(runs == 3);
+  assert(cache.hits() == 2 && cache.misses() == 3);
+  assert(cache.hitRate() == 0.4);
+
+  // "get" is a prefix of "gets", but was followed by another byte.
+  auto longer = fields.run("gets");
+  assert(longer.isSuccess() && longer.value().first.front() == "gets");
+  assert(runs == 4);
+}
+
+void
+test_cached_evicts_the_least_recently_used_fragment()
+{
+  ResultCache<char> cache{ 2 };
+  auto p = cached(letter() < many(letter()), cache);
+  for (auto input : { "ab", "cd", "ab", "ef", "ab", "cd" })
+    assert(p.run(input).isSuccess());
+
+  // "cd" was evicted by "ef", as "ab" had been used since.
+  assert(cache.size() == 2);
+  assert(cache.hits() == 2 && cache.misses() == 4);
+}
+
+void
+test_building_grammars_shares_parsers()
+{
+  // Each level refers to the previous one twice, which used to copy it.
+  auto p = charP('a');
+  for (int i = 0; i < 5000; i++) p = (charP('x') >> p) | p;
+  assert(p.getLabel().size() <= 256);
+  assert(p.run("xxxa").isSuccess());
+
+  auto copy = p;
+  assert(copy.node() == p.node());
+  copy.withLabel("relabelled");
+  assert(copy.getLabel() == "relabelled" && p.getLabel() != "relabelled");
+  assert(copy.node() == p.node());
+}
+
+void
+test_destroying_deep_grammars_does_not_overflow_the_stack()
+{
+  // Releasing each level recursively would take a few frames per level.
+  auto p = charP('a');
+  for (int i = 0; i < 20000; i++) p = charP('x') >> p;
+  assert(p.run("xa").isFailure());
+
+  auto q = std::optional(charP('a'));
+  for (int i = 0; i < 20000; i++) q = q->withLabel("level") | charP('b');
+  q.reset();
+}
+
+void
+test_peg_grammars_capture_named_spans()
+{
+  auto grammar = peg::Grammar::load(R"(
+    # Comma separated assignments.
+    pairs  <- pair (',' pair)*
+    pair   <- key:[a-z_]+ '=' value:(number / string)
+    number <- '-'? [0-9]+
+    string <- '"' text:(!'"' .)* '"'
+  )");
+  assert(grammar.size() == 4);
+
+  auto parser = grammar.compile();
+  auto result = parser.run(R"(a=1,b_c=-22,d="x y";)");
+  assert(result.isSuccess());
+  using C = peg::Capture;
+  assert((result.value().first
+          == peg::Captures{ C{ "key", "a" }, C{ "value", "1" },
+                            C{ "key", "b_c" }, C{ "value", "-22" },
+                            C{ "key", "d" }, C{ "value", "\"x y\"" },
+                            C{ "text", "x y" } }));
+  assert(result.value().second == ";");
+  assert(parser.run("=1").isFailure());
+
+  auto number = grammar.compile("number");
+  assert(number.run("-12").isSuccess());
+  assert(number.run("-12").value().first.empty());
+}
+
+void
+test_peg_grammars_support_recursion_and_predicates()
+{
+  auto grammar = peg::Grammar::load(R"(
+    list  <- '(' (item (' ' item)*)? ')'
+    item  <- list / atom:word
+    word  <- !'nil' [a-z]+
+  )");
+  auto parser = grammar.compile();
+  auto result = parser.run("(a (b c) () d)");
+  assert(result.isSuccess() && result.value().second.empty());
+  assert(result.value().first.size() == 4);
+  assert(result.value().first[3].text == "d");
+  assert(parser.run("(a nil)").isFailure());
+}
+
+void
+test_peg_grammars_reject_invalid_definitions()
+{
+  for (auto text : { "a <- b", "a <- a 'x'", "a <- 'x'*? ", "a <- ('x'",
+                     "a <- 'x' a <- 'y'", "a <- ''*", "a <- [a-" })
+    {
+      bool threw = false;
+      try
+        {
+          [[maybe_unused]] auto grammar = peg::Grammar::load(text);
+        }
+      catch (const ParserError&)
+        {
+          threw = true;
+        }
+      assert(threw);
+    }
+}
+
+void
+test_peg_grammars_serialize()
+{
+  auto grammar = peg::Grammar::load(R"(
+    start <- items:(item (';' item)*)
+    item  <- name:[^;=]+ ('=' [\x30-\x39]+)?
+  )");
+  auto bytes = grammar.serialize();
+  auto loaded = peg::Grammar::deserialize(bytes);
+  assert(loaded.serialize() == bytes);
+
+  auto input = "a=1;bc;d=23";
+  auto expected = grammar.compile().run(input).value();
+  auto result = loaded.compile().run(input).value();
+  assert(result.second == expected.second);
+  assert(result.first.size() == expected.first.size());
+  for (std::size_t i = 0; i < result.first.size(); i++)
+    assert(result.first[i].name == expected.first[i].name
+           && result.first[i].text == expected.first[i].text);
+
+  bool threw = false;
+  try
+    {
+      [[maybe_unused]] auto truncated
+          = peg::Grammar::deserialize(bytes.substr(0, bytes.size() - 1));
+    }
+  catch (const ParserError&)
+    {
+      threw = true;
+    }
+  assert(threw);
+
+  // Well formed bytes for grammars that load() rejects: a <- ''* and
+  // a <- a 'x'.
+  using namespace std::string_view_literals;
+  for (auto bad : { "PEG\x01\x01\x01" "a\x00\x06\x00\x00"sv,
+                    "PEG\x01\x01\x01" "a\x00\x04\x02\x03\x01" "a\x00"
+                    "\x00\x01x"sv,
+                    "PEG\x01\x00"sv })
+    {
+      threw = false;
+      try
+        {
+          [[maybe_unused]] auto loaded = peg::Grammar::deserialize(bad);
+        }
+      catch (const ParserError&)
+        {
+          threw = true;
+        }
+      assert(threw);
+    }
+}
+
+void
+test_records_are_stored_in_columns()
+{
+  Columns<std::string_view, int> people{};
+  auto name = consumed(many1(letter()));
+  auto person = record(people, column<std::string_view>(name < charP(',')),
+                       column<int>(decimal()));
+  auto file = skipSepBy(person, charP('\n'));
+
+  auto result = file.run("ann,31\nbob,27\ncarl,x");
+  assert(result.isSuccess());
+  assert(result.value().second == "\ncarl,x");
+
+  // The failed record left nothing behind.
+  assert(people.size() == 2);
+  assert((people.column<0>() == std::vector<std::string_view>{ "ann", "bob" }));
+  assert((people.column<1>() == std::vector<int>{ 31, 27 }));
+
+  assert(person.run("dan,40").value().first == 2);
+  assert(people.column<1>().back() == 40);
+  people.clear();
+  assert(people.size() == 0 && people.column<0>().empty());
+
+  // Records that a choice backtracks over are left behind, unless the
+  // branch runs as a transaction.
+  auto loose = (person < charP('!')) | (person < charP('?'));
+  assert(loose.run("ann,31?").isSuccess());
+  assert(people.size() == 2);
+  people.clear();
+
+  auto strict = transaction(people, person < charP('!'))
+              | (person < charP('?'));
+  assert(strict.run("ann,31?").isSuccess());
+  assert(people.size() == 1 && people.column<1>()[0] == 31);
+
+  auto list = transaction(people, sepBy(person, charP(';')) < charP('.'));
+  assert(list.run("bob,27;carl,40;dan").isFailure());
+  assert(people.size() == 1);
+  assert(people.column<0>().size() == 1 && people.column<1>().size() == 1);
+  assert(list.run("bob,27;carl,40.").isSuccess());
+  assert(people.size() == 3);
+}
+
+void
+test_incremental_parsing_reuses_unedited_results()
+{
+  Document config{ "a=1\nb=2\nc=3\n" };
+  auto entry = incremental(letter() >> charP('=') >> decimal() < charP('\n'),
+                           config);
+  auto entries = many(entry);
+
+  auto first = config.parse(entries);
+  assert((first.value().first == std::list<int>{ 1, 2, 3 }));
+  assert(config.reparsed() == 4 && config.reused() == 0);
+
+  // Only the entry that contains the edit is parsed again.
+  config.edit(6, 1, "20");
+  auto second = config.parse(entries);
+  assert((second.value().first == std::list<int>{ 1, 20, 3 }));
+  assert(config.reparsed() == 1 && config.reused() == 3);
+
+  // Entries that follow an insertion are moved, and the one that looked at
+  // the byte where it happens is parsed again.
+  config.edit(4, 0, "x=9\n");
+  auto third = config.parse(entries);
+  assert((third.value().first == std::list<int>{ 1, 9, 20, 3 }));
+  assert(config.reparsed() == 2 && config.reused() == 3);
+  assert(config.text() == "a=1\nx=9\nb=20\nc=3\n");
+
+  // Removing the end of the input makes the last entry fail.
+  config.edit(config.text().size() - 2, 2, "");
+  auto fourth = config.parse(entries);
+  assert((fourth.value().first == std::list<int>{ 1, 9, 20 }));
+  assert(fourth.value().second == "c=");
+
+  // The failure of the last entry depended on the end of the text.
+  config.edit(config.text().size(), 0, "3\n");
+  auto fifth = config.parse(entries);
+  assert((fifth.value().first == std::list<int>{ 1, 9, 20, 3 }));
+  assert(fifth.value().second.empty());
+}
+
+void
+test_incremental_parsing_drops_results_of_destroyed_parsers()
+{
+  Document document{ "a=1\nc=" };
+  for (int i = 0; i < 3; i++)
+    {
+      auto entry = incremental(
+          letter() >> charP('=') >> decimal() < charP('\n'), document);
+      auto result = document.parse(many(entry));
+      assert(result.value().first.size() == 1);
+      assert(document.reparsed() == 2 && document.reused() == 0);
+    }
+  document.edit(6, 0, "3\n");
+
+  auto entry
+      = incremental(letter() >> charP('=') >> decimal() < charP('\n'),
+                    document);
+  auto entries = many(entry);
+  assert(document.parse(entries).value().first.size() == 2);
+  document.edit(6, 1, "4");
+  assert((document.parse(entries).value().first
+          == std::list<int>{ 1, 4 }));
+  assert(document.reparsed() == 1 && document.reused() == 2);
+}
+
+void
+test_adaptive_choice_tries_frequent_branches_first()
+{
+  BranchStats stats{ 4 };
+  auto letter = adaptiveChoice(stats, charP('a'), charP('b'), charP('c'));
+  auto letters = many(letter);
+
+  auto result = letters.run("ccccccccab");
+  assert(result.value().first == std::list<char>({ 'c', 'c', 'c', 'c', 'c',
+                                                   'c', 'c', 'c', 'a', 'b' }));
+
+  assert(stats.size() == 3);
+  assert(stats.successes(0) == 1 && stats.successes(1) == 1);
+  assert(stats.successes(2) == 8);
+  assert(stats.failures() == 1);
+  // Three tries for each of the first four c, then one try for the others.
+  assert(stats.attempts() == 4 * 3 + 4 * 1 + 2 + 3 + 3);
+  assert((stats.order() == std::vector<std::size_t>{ 2, 0, 1 }));
+
+  // The error does not depend on the order, and stats are not shared.
+  assert(letter.run("z").asError().show()
+         == charP('c').run("z").asError().show());
+  bool threw = false;
+  try
+    {
+      [[maybe_unused]] auto other = adaptiveChoice(stats, charP('a'));
+    }
+  catch (const ParserError&)
+    {
+      threw = true;
+    }
+  assert(threw && stats.size() == 3 && stats.successes(2) == 8);
+}
+
+void
+test_nesting_depth_is_limited()
+{
+  auto nesting = recursive<int>([](const Parser<int>& self) {
+    auto nested = charP('[') >> self < charP(']');
+    return (nested & [](int depth) { return depth + 1; })
+         | (charP('x') & [](char) { return 0; });
+  });
+  assert(nesting.runThrowing("[[[x]]]") == 3);
+
+  // Fails rather than overflowing the stack.
+  auto deep = std::string(100000, '[') + "x" + std::string(100000, ']');
+  auto exceeded = [](const auto& result) {
+    return result.isFatal()
+        && result.asError().show().ends_with(
+            "Maximum nesting depth exceeded");
+  };
+  assert(exceeded(nesting.run(deep)));
+  assert(nesting.runThrowing("[x]") == 1);
+
+  // Repetitions and choices do not stop at the limit as if the input ended
+  // there, and a parse that reached it leaves the next one unaffected.
+  assert(exceeded(many(nesting).run(deep)));
+  assert(exceeded((nesting | charP('[') >> nesting).run(deep)));
+  assert(many(nesting).runThrowing("[x][[x]]x").size() == 3);
+  assert(exceeded(compile(many(nesting)).run(deep)));
+  assert(!nesting.recognize(deep));
+
+  {
+    DepthLimit limit{ 2 };
+    assert(nesting.runThrowing("[[x]]") == 2);
+    assert(exceeded(nesting.run("[[[x]]]")));
+  }
+  assert(nesting.runThrowing("[[[x]]]") == 3);
+
+  // Alternatives that share a prefix are not all tried at every level,
+  // which would take time exponential in the limit.
+  auto brackets = recursive<char>([](const Parser<char>& self) {
+    return (charP('[') >> self < charP(']'))
+         | (charP('[') >> self < charP(')')) | charP('x');
+  });
+  {
+    DepthLimit limit{ 64 };
+    assert(brackets.runThrowing("[[x])") == 'x');
+    assert(exceeded(brackets.run(std::string(65, '[') + "x")));
+  }
+
+  // Right associative chains, prefix operators and bind nest as well.
+  std::string powers = "1";
+  for (int i = 0; i < 100000; i++) powers += "^1";
+  auto power = chainr1(digit() & [](char c) { return c - '0'; },
+                       charP('^') & [](char) {
+                         return [](int a, int b) { return a * b; };
+                       });
+  assert(power.runThrowing("1^1^1") == 1);
+  assert(exceeded(power.run(powers)));
+
+  auto table = OperatorTable<int>{
+    { prefix<int>(charP('-'), std::negate<>{}) },
+    { infixr<int>(charP('^'), std::multiplies<>{}) },
+  };
+  auto expr = expression(decimal(), table);
+  assert(expr.runThrowing("--1^-1") == -1);
+  assert(exceeded(expr.run(std::string(100000, '-') + "1")));
+  assert(exceeded(expr.run(powers)));
+
+  auto counted = recursive<int>([](const Parser<int>& self) {
+    return (charP('(') >>= [self](char) { return self < charP(')'); })
+         | (charP('x') & [](char) { return 0; });
+  });
+  assert(counted.runThrowing("((x))") == 0);
+  assert(exceeded(counted.run(std::string(100000, '(') + "x")));
+
+  auto grammar = peg::Grammar::load("list <- '(' list* ')'");
+  auto lists = grammar.compile("list");
+  DepthLimit limit{ 8 };
+  assert(lists.run("((()()))").isSuccess());
+  assert(exceeded(lists.run(std::string(16, '(') + std::string(16, ')'))));
+}
+
+void
+test_nesting_depth_is_limited_on_small_stacks()
+{
+  // The limit shrinks to fit the stack of the running thread, so deep
+  // inputs fail there too, well under the default number of levels.
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, 64 * 1024);
+
+  static bool passed = false;
+  pthread_t thread;
+  auto run = [](void*) -> void* {
+    auto nesting = recursive<char>([](const Parser<char>& self) {
+      return (charP('[') >> self < charP(']')) | charP('x');
+    });
+    auto exceeded = [](const auto& result) {
+      return result.isFatal()
+          && result.asError().show().ends_with(
+              "Maximum nesting depth exceeded");
+    };
+    auto lists = peg::Grammar::load("list <- '(' list* ')'").compile("list");
+    auto power = chainr1(digit(), charP('^') & [](char) {
+      return [](char a, char) { return a; };
+    });
+    std::string powers = "1";
+    for (int i = 0; i < 1000; i++) powers += "^1";
+
+    passed = nesting.runThrowing("[[[x]]]") == 'x'
+          && exceeded(nesting.run(std::string(1000, '[')))
+          && lists.run("(()())").isSuccess()
+          && exceeded(lists.run(std::string(1000, '(')))
+          && power.runThrowing("1^1^1") == '1' && exceeded(power.run(powers));
+    return nullptr;
+  };
+  assert(pthread_create(&thread, &attributes, run, nullptr) == 0);
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attributes);
+  assert(passed);
 }
 
 auto
@@ -331,9 +1838,12 @@ main() -> int
   testMany1FailsWhenItCanMatchAtLeastOnce();
   testParsingWhitespace();
   testIgnoringTheRightResultWorks();
+  test_map_and_sequencing_move_values_instead_of_copying_them();
 
   // takeWhile
   test_takeWhile_works_with_valid_input();
+  test_takeWhile_stops_at_the_end_of_the_input();
+  test_takeWhile_works_over_spans();
 
   // skipWhile
   test_skipWhile_works_with_valid_input();
@@ -345,5 +1855,128 @@ main() -> int
   // sepBy
   test_sepBy_works_with_valid_input();
   test_sepBy_works_with_invalid_input();
+
+  // count
+  test_count_parses_exactly_n_ocurrences();
+  test_count_fails_when_there_are_too_few_ocurrences();
+
+  // manyTill
+  test_manyTill_stops_at_the_end_parser();
+  test_manyTill_fails_when_end_is_never_found();
+
+  // sepEndBy
+  test_sepEndBy_accepts_an_optional_trailing_separator();
+
+  // endBy
+  test_endBy_requires_a_separator_after_each_ocurrence();
+
+  // between
+  test_between_returns_the_value_of_the_inner_parser();
+
+  // chainl1 and chainr1
+  test_chainl1_folds_from_the_left();
+  test_chainr1_folds_from_the_right();
+
+  // skipMany and skipSepBy
+  test_skipMany_counts_the_ocurrences();
+  test_skipSepBy_counts_the_ocurrences();
+
+  // seq and construct
+  test_seq_into_constructs_an_aggregate();
+  test_seq_apply_calls_the_function_with_every_value();
+  test_construct_uses_the_constructor_of_the_type();
+
+  // Generic input
+  test_satisfy_works_over_other_inputs();
+
+  // Binary primitives
+  test_fixed_width_integers_honor_byte_order();
+  test_f64le_decodes_a_double();
+  test_varint_decodes_multi_byte_values();
+  test_lengthPrefixed_runs_the_parser_over_the_frame();
+
+  // JSON
+  test_json_reader_parses_nested_documents();
+  test_json_reader_strings_point_into_the_input();
+  test_json_reader_rejects_invalid_documents();
+  test_json_reader_values_compose_with_other_parsers();
+
+  // consumed and intern
+  test_consumed_returns_the_consumed_input();
+  test_intern_maps_repeated_names_to_the_same_symbol();
+  test_concurrent_symbol_table_can_be_shared_across_threads();
+
+  // CSV
+  test_csv_reader_splits_records_and_fields();
+  test_csv_reader_handles_fields_longer_than_a_block();
+  test_csv_reader_rejects_malformed_quoted_fields();
+
+  // Expressions
+  test_expression_honors_precedence_and_associativity();
+
+  // Lexer
+  test_lexer_splits_input_into_tokens();
+  test_lexer_patterns_support_quantifiers_and_alternation();
+  test_parsers_run_over_tokens();
+  test_regex_matches_the_longest_prefix();
+  test_regex_rejects_hostile_patterns();
+  test_regex_runs_in_compiled_parsers();
+
+  // UTF-8
+  test_ascii_classifiers_ignore_the_locale();
+  test_utf8_parsers_decode_code_points();
+  test_utf8_validates_the_input_up_front();
+
+  // Error recovery
+  test_skipUntil_skips_past_the_end_parser();
+  test_recover_collects_every_error_in_one_pass();
+  test_recover_errors_are_forgotten_when_a_transaction_fails();
+
+  // Optimizer
+  test_optimize_fuses_characters_into_literals();
+  test_optimize_scans_repeated_characters_in_bulk();
+  test_optimize_left_factors_alternatives();
+  test_optimize_shares_identical_sub_parsers();
+  test_recognize_builds_no_values();
+  test_recognize_runs_parsers_of_unknown_structure();
+
+  // Parsing machine
+  test_compiled_parsers_match_like_the_original();
+  test_compiled_parsers_return_the_captures();
+  test_compiled_parsers_call_shared_rules_and_opaque_parsers();
+
+  // Streams
+  test_parseStream_yields_records_one_at_a_time();
+  test_parseStream_stops_after_an_error();
+  test_fd_source_parses_records_across_reads();
+  test_fd_source_stops_without_waiting_for_input();
+
+  // Caching
+  test_cached_reuses_values_of_repeated_fragments();
+  test_cached_evicts_the_least_recently_used_fragment();
+
+  // Construction
+  test_building_grammars_shares_parsers();
+  test_destroying_deep_grammars_does_not_overflow_the_stack();
+
+  // Grammars
+  test_peg_grammars_capture_named_spans();
+  test_peg_grammars_support_recursion_and_predicates();
+  test_peg_grammars_reject_invalid_definitions();
+  test_peg_grammars_serialize();
+
+  // Columnar output
+  test_records_are_stored_in_columns();
+
+  // Incremental parsing
+  test_incremental_parsing_reuses_unedited_results();
+  test_incremental_parsing_drops_results_of_destroyed_parsers();
+
+  // Adaptive choice
+  test_adaptive_choice_tries_frequent_branches_first();
+
+  // Recursion
+  test_nesting_depth_is_limited();
+  test_nesting_depth_is_limited_on_small_stacks();
   return 0;
 }